@@ -1,12 +1,60 @@
 #include <iostream>
 #include <string>
 #include <unordered_map>
-#include <queue>
 #include <vector>
+#include <queue>
+#include <set>
 #include <chrono>
 #include <iomanip>
 #include <algorithm>
+#include <iterator>
 #include <sstream>
+#include <fstream>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+#include <cctype>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <memory>
+#include <new>
+#include <limits>
+#include <stdexcept>
+#include <functional>
+#include <thread>
+#include <condition_variable>
+#include <future>
+#include <random>
+#ifdef __unix__
+#include <sys/resource.h>
+#endif
+#include <type_traits>
+#include <cstddef>
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <csignal>
+#endif
 
 using namespace std;
 using namespace chrono;
@@ -15,488 +63,5099 @@ class User;
 class Auction;
 class AuctionSystem;
 
-struct Bid {
-    string userId;
-    double amount;
-    time_point<steady_clock> timestamp;
-    string itemId;
-    
-    Bid(const string& uid, double amt, const string& iid) : userId(uid), amount(amt), timestamp(steady_clock::now()), itemId(iid) {}
-    
-    // For priority queue (max heap based on amount)
-    bool operator<(const Bid& other) const {
-        if (amount != other.amount) {
-            return amount < other.amount; // Higher amount has higher priority
+// Users and items are addressed by dense 32-bit indexes internally. The
+// "ID1000" style strings shown to people only exist in a SymbolTable.
+using UserId = uint32_t;
+using ItemId = uint32_t;
+const uint32_t NO_ID = UINT32_MAX;
+
+// Longest auction accepted, in whole minutes; keeps end times well inside
+// what steady_clock can represent
+const int MAX_AUCTION_MINUTES = 10 * 366 * 24 * 60;
+
+// Append-only array whose elements never move once constructed, so other
+// threads can keep indexing it while it grows. Appends must be serialized by
+// the caller; size() only counts fully constructed elements.
+template <typename T>
+class StableVector {
+private:
+    static constexpr size_t SEGMENT_BITS = 12;
+    static constexpr size_t SEGMENT_SIZE = size_t(1) << SEGMENT_BITS;
+    static constexpr size_t MAX_SEGMENTS = size_t(1) << 16;
+
+    unique_ptr<atomic<T*>[]> segments;
+    atomic<size_t> count;
+
+public:
+    StableVector() : segments(new atomic<T*>[MAX_SEGMENTS]), count(0) {
+        for (size_t i = 0; i < MAX_SEGMENTS; i++) {
+            segments[i].store(nullptr, memory_order_relaxed);
+        }
+    }
+
+    StableVector(const StableVector&) = delete;
+    StableVector& operator=(const StableVector&) = delete;
+
+    ~StableVector() {
+        size_t n = count.load(memory_order_relaxed);
+        for (size_t i = 0; i < n; i++) {
+            (*this)[i].~T();
+        }
+        for (size_t i = 0; i < MAX_SEGMENTS; i++) {
+            T* segment = segments[i].load(memory_order_relaxed);
+            if (segment == nullptr) {
+                break;
+            }
+            ::operator delete(segment, align_val_t(alignof(T)));
+        }
+    }
+
+    template <typename... Args>
+    T& emplace_back(Args&&... args) {
+        size_t n = count.load(memory_order_relaxed);
+        size_t segmentIndex = n >> SEGMENT_BITS;
+        if (segmentIndex >= MAX_SEGMENTS) {
+            throw length_error("StableVector capacity exceeded");
+        }
+        T* segment = segments[segmentIndex].load(memory_order_relaxed);
+        if (segment == nullptr) {
+            segment = static_cast<T*>(::operator new(sizeof(T) * SEGMENT_SIZE, align_val_t(alignof(T))));
+            segments[segmentIndex].store(segment, memory_order_release);
+        }
+        T* element = new (segment + (n & (SEGMENT_SIZE - 1))) T(std::forward<Args>(args)...);
+        count.store(n + 1, memory_order_release);
+        return *element;
+    }
+
+    T& operator[](size_t i) {
+        return segments[i >> SEGMENT_BITS].load(memory_order_acquire)[i & (SEGMENT_SIZE - 1)];
+    }
+
+    const T& operator[](size_t i) const {
+        return segments[i >> SEGMENT_BITS].load(memory_order_acquire)[i & (SEGMENT_SIZE - 1)];
+    }
+
+    size_t size() const {
+        return count.load(memory_order_acquire);
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    // Calls fn(elements, firstIndex, count) for each contiguous run in [0, size())
+    template <typename Fn>
+    void forEachRun(Fn fn) const {
+        size_t n = size();
+        for (size_t first = 0; first < n; first += SEGMENT_SIZE) {
+            fn(&(*this)[first], first, min(SEGMENT_SIZE, n - first));
         }
-        return timestamp > other.timestamp; // Earlier timestamp has higher priority for same amount
     }
 };
 
-struct Item {
-    string id;
-    string name;
-    string description;
-    double startingPrice;
-    double reservePrice;
-    string sellerId;
-    time_point<steady_clock> startTime;
-    time_point<steady_clock> endTime;
-    bool isActive;
-    
-    Item(const string& itemId, const string& itemName, const string& desc,
-         double startPrice, double reserve, const string& seller, int durationMinutes)
-        : id(itemId), name(itemName), description(desc), startingPrice(startPrice),
-          reservePrice(reserve), sellerId(seller), isActive(true) {
-        startTime = steady_clock::now();
-        endTime = startTime + minutes(durationMinutes);
+// Two-way mapping between display IDs and dense indexes.
+// name() may be called from any thread; intern() and find() need the
+// owner's lock.
+class SymbolTable {
+private:
+    StableVector<string> names;
+    unordered_map<string, uint32_t> index;
+
+public:
+    uint32_t intern(const string& name) {
+        auto it = index.find(name);
+        if (it != index.end()) {
+            return it->second;
+        }
+        uint32_t id = (uint32_t)names.size();
+        names.emplace_back(name);
+        index.emplace(name, id);
+        return id;
     }
 
-    bool isExpired() const {
-        return steady_clock::now() > endTime;
+    // Returns NO_ID for unknown names
+    uint32_t find(const string& name) const {
+        auto it = index.find(name);
+        return it == index.end() ? NO_ID : it->second;
     }
-    
-    int getRemainingSeconds() const {
-        auto remaining = duration_cast<seconds>(endTime - steady_clock::now());
-        return max(0, (int)remaining.count());
+
+    const string& name(uint32_t id) const {
+        return names[id];
+    }
+
+    size_t size() const {
+        return names.size();
+    }
+
+    void reserve(size_t count) {
+        index.reserve(count);
     }
 };
 
-class Auction {
+// Explicit per-caller login state. The thread-safe entry points of
+// AuctionSystem take one per call, so concurrent clients never share a
+// "current user".
+struct Session {
+    UserId userId = NO_ID;
+
+    bool loggedIn() const {
+        return userId != NO_ID;
+    }
+};
+
+// Size-classed free lists for the small containers that grow on every bid:
+// bid logs, per-user item lists and FlatIdMap tables. Blocks are powers of
+// two from 64 bytes to 64 KB; larger requests go straight to operator new.
+// Each thread keeps the blocks it frees and hands them out again, so
+// steady-state bidding recycles memory instead of calling the global heap
+// and shard workers never contend on an allocator lock. A thread's cache is
+// returned to the heap when it exits.
+class BlockPool {
 private:
-    Item item;
-    priority_queue<Bid> bids; // Max heap for bids
-    unordered_map<string, double> userHighestBids; // Track highest bid per user
-    vector<Bid> bidHistory; // Complete bid history
+    static constexpr size_t MIN_SHIFT = 6;
+    static constexpr size_t MAX_SHIFT = 16;
+    static constexpr size_t CLASSES = MAX_SHIFT - MIN_SHIFT + 1;
+    static constexpr size_t CACHE_BYTES = 256 << 10; // per class, beyond which blocks are freed
+    
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+    
+    FreeBlock* freeLists[CLASSES] = {};
+    size_t cachedBytes[CLASSES] = {};
+    
+    static size_t classOf(size_t bytes) {
+        size_t shift = MIN_SHIFT;
+        while (((size_t)1 << shift) < bytes) {
+            shift++;
+        }
+        return shift - MIN_SHIFT;
+    }
     
 public:
-    Auction(const Item& itm) : item(itm) {}
+    BlockPool() = default;
+    BlockPool(const BlockPool&) = delete;
+    BlockPool& operator=(const BlockPool&) = delete;
     
-    bool isActive() const {
-        return item.isActive && !item.isExpired();
+    ~BlockPool() {
+        for (FreeBlock* head : freeLists) {
+            while (head != nullptr) {
+                FreeBlock* next = head->next;
+                ::operator delete(head);
+                head = next;
+            }
+        }
     }
     
-    void endAuction() {
-        item.isActive = false;
+    static BlockPool& local() {
+        static thread_local BlockPool pool;
+        return pool;
     }
     
-    bool placeBid(const string& userId, double amount) {
-        if (!isActive()) {
-            cout << "Auction is not active!" << endl;
-            return false;
-        }
-        
-        if (amount <= item.startingPrice) {
-            cout << "Bid must be higher than starting price: $" << item.startingPrice << endl;
-            return false;
-        }
-        
-        // Check if bid is higher than current highest bid
-        if (!bids.empty() && amount <= bids.top().amount) {
-            cout << "Bid must be higher than current highest bid: $" << bids.top().amount << endl;
-            return false;
+    void* allocate(size_t bytes) {
+        if (bytes > ((size_t)1 << MAX_SHIFT)) {
+            return ::operator new(bytes);
         }
-        
-        // Check if user is trying to bid on their own item
-        if (userId == item.sellerId) {
-            cout << "Cannot bid on your own item!" << endl;
-            return false;
+        size_t sizeClass = classOf(bytes);
+        FreeBlock* block = freeLists[sizeClass];
+        if (block == nullptr) {
+            return ::operator new((size_t)1 << (sizeClass + MIN_SHIFT));
         }
-        
-        Bid newBid(userId, amount, item.id);
-        bids.push(newBid);
-        bidHistory.push_back(newBid);
-        
-        // Update user's highest bid
-        userHighestBids[userId] = max(userHighestBids[userId], amount);
-        
-        cout << "Bid placed successfully! Current highest bid: $" << amount << endl;
-        return true;
+        freeLists[sizeClass] = block->next;
+        cachedBytes[sizeClass] -= (size_t)1 << (sizeClass + MIN_SHIFT);
+        return block;
     }
     
-    Bid getHighestBid() const {
-        if (bids.empty()) {
-            return Bid("", 0.0, item.id);
+    void deallocate(void* pointer, size_t bytes) {
+        if (bytes > ((size_t)1 << MAX_SHIFT)) {
+            ::operator delete(pointer);
+            return;
         }
-        return bids.top();
-    }
-    
-    double getCurrentPrice() const {
-        if (bids.empty()) {
-            return item.startingPrice;
+        size_t sizeClass = classOf(bytes);
+        size_t blockBytes = (size_t)1 << (sizeClass + MIN_SHIFT);
+        if (cachedBytes[sizeClass] + blockBytes > CACHE_BYTES) {
+            ::operator delete(pointer);
+            return;
         }
-        return bids.top().amount;
+        FreeBlock* block = static_cast<FreeBlock*>(pointer);
+        block->next = freeLists[sizeClass];
+        freeLists[sizeClass] = block;
+        cachedBytes[sizeClass] += blockBytes;
     }
+};
+
+// Standard allocator over BlockPool::local(). Memory may be freed on a
+// different thread than it came from; it then joins that thread's cache.
+template <typename T>
+struct PoolAllocator {
+    using value_type = T;
     
-    const Item& getItem() const {
-        return item;
-    }
+    PoolAllocator() = default;
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U>&) {}
     
-    vector<Bid> getBidHistory() const {
-        return bidHistory;
+    T* allocate(size_t n) {
+        return static_cast<T*>(BlockPool::local().allocate(n * sizeof(T)));
     }
     
-    unordered_map<string, double> getUserBids() const {
-        return userHighestBids;
+    void deallocate(T* pointer, size_t n) {
+        BlockPool::local().deallocate(pointer, n * sizeof(T));
     }
     
-    bool hasReserveBeenMet() const {
-        return getCurrentPrice() >= item.reservePrice;
+    template <typename U>
+    bool operator==(const PoolAllocator<U>&) const { return true; }
+    template <typename U>
+    bool operator!=(const PoolAllocator<U>&) const { return false; }
+};
+
+template <typename T>
+using PoolVector = vector<T, PoolAllocator<T>>;
+
+
+// Open-addressing hash map keyed by a dense ID. Keys and values sit in one
+// flat array, so there are no per-entry node allocations.
+template <typename V>
+class FlatIdMap {
+private:
+    struct Slot {
+        uint32_t key;
+        V value;
+    };
+
+    PoolVector<Slot> slots;
+    size_t count = 0;
+
+    static size_t hash(uint32_t key) {
+        return (size_t)(key * 2654435761u);
     }
-    
-    void displayAuctionInfo() const {
-        cout << "\n=== Auction Details ===" << endl;
-        cout << "Item: " << item.name << " (ID: " << item.id << ")" << endl;
-        cout << "Description: " << item.description << endl;
-        cout << "Starting Price: $" << item.startingPrice << endl;
-        cout << "Reserve Price: $" << item.reservePrice << endl;
-        cout << "Current Price: $" << getCurrentPrice() << endl;
-        cout << "Seller: " << item.sellerId << endl;
-        cout << "Status: " << (isActive() ? "Active" : "Ended") << endl;
-        cout << "Time Remaining: " << item.getRemainingSeconds() << " seconds" << endl;
-        cout << "Reserve Met: " << (hasReserveBeenMet() ? "Yes" : "No") << endl;
-        cout << "Total Bids: " << bidHistory.size() << endl;
-        
-        if (!bids.empty()) {
-            cout << "Highest Bidder: " << bids.top().userId << endl;
+
+    void grow() {
+        PoolVector<Slot> old;
+        old.swap(slots);
+        slots.assign(old.empty() ? 8 : old.size() * 2, Slot{NO_ID, V()});
+        count = 0;
+        for (auto& slot : old) {
+            if (slot.key != NO_ID) {
+                (*this)[slot.key] = std::move(slot.value);
+            }
         }
     }
-};
 
-class User {
 public:
-    string id;
-    string username;
-    string email;
-    double balance;
-    vector<string> bidHistory;
-    vector<string> ownedItems;
-    vector<string> soldItems;
-    
-    User(const string& userId, const string& uname, const string& mail, double bal = 0.0)
-        : id(userId), username(uname), email(mail), balance(bal) {}
+    V* find(uint32_t key) {
+        if (slots.empty()) {
+            return nullptr;
+        }
+        size_t mask = slots.size() - 1;
+        for (size_t i = hash(key) & mask;; i = (i + 1) & mask) {
+            if (slots[i].key == key) return &slots[i].value;
+            if (slots[i].key == NO_ID) return nullptr;
+        }
+    }
+
+    const V* find(uint32_t key) const {
+        return const_cast<FlatIdMap*>(this)->find(key);
+    }
+
+    V& operator[](uint32_t key) {
+        if ((count + 1) * 4 > slots.size() * 3) {
+            grow();
+        }
+        size_t mask = slots.size() - 1;
+        size_t i = hash(key) & mask;
+        while (slots[i].key != key && slots[i].key != NO_ID) {
+            i = (i + 1) & mask;
+        }
+        if (slots[i].key == NO_ID) {
+            slots[i].key = key;
+            count++;
+        }
+        return slots[i].value;
+    }
+
+    size_t size() const {
+        return count;
+    }
+
+    // Empties the map and gives its table back to the pool
+    void release() {
+        PoolVector<Slot>().swap(slots);
+        count = 0;
+    }
+
+    template <typename Fn>
+    void forEach(Fn fn) const {
+        for (const auto& slot : slots) {
+            if (slot.key != NO_ID) {
+                fn(slot.key, slot.value);
+            }
+        }
+    }
+};
+
+// The time seen by everything that stamps bids and items or decides expiry.
+// It follows the real clocks unless pinned; a batch replay pins it to each
+// command's logical time (see the T command), so expiry and timestamps come
+// out as they did when the stream was recorded. Latency measurements keep
+// using steady_clock directly.
+class Clock {
+private:
+    static constexpr int64_t UNPINNED = numeric_limits<int64_t>::min();
     
-    bool canBid(double amount) const {
-        return balance >= amount;
+    static atomic<int64_t>& pinnedSteady() {
+        static atomic<int64_t> ticks{UNPINNED};
+        return ticks;
     }
     
-    void deductBalance(double amount) {
-        if (balance >= amount) {
-            balance -= amount;
-        }
+    static atomic<int64_t>& pinnedWall() {
+        static atomic<int64_t> ticks{UNPINNED};
+        return ticks;
     }
     
-    void addBalance(double amount) {
-        balance += amount;
+public:
+    static time_point<steady_clock> now() {
+        int64_t ticks = pinnedSteady().load(memory_order_relaxed);
+        return ticks == UNPINNED ? steady_clock::now() : time_point<steady_clock>(steady_clock::duration(ticks));
     }
     
-    void addBidToHistory(const string& itemId) {
-        bidHistory.push_back(itemId);
+    static time_point<system_clock> wallNow() {
+        int64_t ticks = pinnedWall().load(memory_order_relaxed);
+        return ticks == UNPINNED ? system_clock::now() : time_point<system_clock>(system_clock::duration(ticks));
     }
     
-    void addOwnedItem(const string& itemId) {
-        ownedItems.push_back(itemId);
+    static void pin(time_point<steady_clock> steady, time_point<system_clock> wall) {
+        pinnedSteady().store(steady.time_since_epoch().count(), memory_order_relaxed);
+        pinnedWall().store(wall.time_since_epoch().count(), memory_order_relaxed);
     }
     
-    void addSoldItem(const string& itemId) {
-        soldItems.push_back(itemId);
+    static void release() {
+        pinnedSteady().store(UNPINNED, memory_order_relaxed);
+        pinnedWall().store(UNPINNED, memory_order_relaxed);
     }
 };
 
+// One accepted bid. The item is implied by the auction the bid lives in.
+// Plain 24-byte record with a wall-clock timestamp, so bid logs can be
+// written to and served straight from a memory-mapped snapshot.
+struct Bid {
+    UserId bidder;
+    double amount;
+    time_point<system_clock> timestamp;
+    
+    Bid(UserId uid, double amt) : bidder(uid), amount(amt), timestamp(Clock::wallNow()) {}
+    
+    Bid(UserId uid, double amt, time_point<system_clock> time) : bidder(uid), amount(amt), timestamp(time) {}
+};
 
+static_assert(is_trivially_copyable<Bid>::value && sizeof(Bid) == 24, "Bid is stored verbatim in snapshots");
 
-class AuctionSystem {
+// Read-only view over a contiguous run of bids, oldest first
+class BidSpan {
 private:
-    unordered_map<string, User> users;
-    unordered_map<string, Auction> auctions;
-    unordered_map<string, vector<string>> userAuctions; // user -> list of auction IDs
-    string currentUserId;
+    const Bid* first = nullptr;
+    size_t count = 0;
+
+public:
+    BidSpan() {}
+    BidSpan(const Bid* data, size_t size) : first(data), count(size) {}
+
+    const Bid* begin() const { return first; }
+    const Bid* end() const { return first + count; }
+    reverse_iterator<const Bid*> rbegin() const { return reverse_iterator<const Bid*>(end()); }
+    reverse_iterator<const Bid*> rend() const { return reverse_iterator<const Bid*>(begin()); }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    const Bid& operator[](size_t i) const { return first[i]; }
+    const Bid& back() const { return first[count - 1]; }
     
-    string generateId() {
-        static int counter = 1000;
-        return "ID" + to_string(counter++);
+    // The bids ranked [offset, offset + limit) counting from the newest, still
+    // oldest first; walk it with rbegin/rend for newest-first order. limit 0
+    // means no limit.
+    BidSpan newest(size_t offset, size_t limit) const {
+        offset = min(offset, count);
+        size_t n = count - offset;
+        if (limit != 0) {
+            n = min(n, limit);
+        }
+        return BidSpan(first + (count - offset - n), n);
     }
+};
+
+// Highest bid of each of the best TopBidders::CAPACITY distinct bidders,
+// kept sorted best first. Updates are O(CAPACITY) so they can run on every bid.
+class TopBidders {
+public:
+    static constexpr size_t CAPACITY = 5;
+    
+    struct Entry {
+        UserId bidder;
+        double amount;
+    };
+    
+private:
+    Entry entries[CAPACITY];
+    size_t count = 0;
     
 public:
-    // User Management
-    bool registerUser(const string& username, const string& email, double initialBalance = 1000.0) {
-        string userId = generateId();
-        
-        // Check if username already exists
-        for (const auto& pair : users) {
-            if (pair.second.username == username) {
-                cout << "Username already exists!" << endl;
-                return false;
+    // Records that `bidder` now bids `amount`; lower amounts than the bidder's
+    // current entry are ignored
+    void update(UserId bidder, double amount) {
+        size_t pos = 0;
+        while (pos < count && entries[pos].bidder != bidder) {
+            pos++;
+        }
+        if (pos < count) {
+            if (amount <= entries[pos].amount) {
+                return;
             }
+        } else if (count < CAPACITY) {
+            pos = count++;
+        } else if (amount > entries[CAPACITY - 1].amount) {
+            pos = CAPACITY - 1;
+        } else {
+            return;
         }
-        
-        users[userId] = User(userId, username, email, initialBalance);
-        cout << "User registered successfully! User ID: " << userId << endl;
-        return true;
+        // Slide the entry up to its new rank
+        while (pos > 0 && entries[pos - 1].amount < amount) {
+            entries[pos] = entries[pos - 1];
+            pos--;
+        }
+        entries[pos] = {bidder, amount};
     }
+    
+    bool full() const { return count == CAPACITY; }
+    const Entry* begin() const { return entries; }
+    const Entry* end() const { return entries + count; }
+    size_t size() const { return count; }
+};
 
+enum class BidStatus {
+    Accepted,
+    NotLoggedIn,
+    AuctionNotFound,
+    AuctionInactive,
+    BelowStartingPrice,
+    BelowCurrentBid,
+    OwnItem,
+    InsufficientBalance,
+    Outbid, // valid, but a standing proxy bid answered it at once
+    RateLimited, // the user is over their bid rate; see setBidRateLimit
+    Overloaded, // the auction's shard queue is full
+    BelowMinimumIncrement // under the current bid plus the auction's increment
+};
 
-    bool loginUser(const string& username) {
-        for (const auto& pair : users) {
-            if (pair.second.username == username) {
-                currentUserId = pair.first;
-                cout << "Login successful! Welcome " << username << endl;
-                return true;
-            }
-        }
-        cout << "User not found!" << endl;
-        return false;
-    }
+// Outcome of a bid. `reference` carries the value the bid was checked against:
+// the starting price, the current highest bid, the least acceptable bid or
+// the bidder's balance.
+struct BidResult {
+    BidStatus status;
+    double amount;
+    double reference;
 
+    BidResult(BidStatus st, double amt, double ref = 0.0) : status(st), amount(amt), reference(ref) {}
 
-    void logoutUser() {
-        currentUserId = "";
-        cout << "Logged out successfully!" << endl;
+    bool accepted() const {
+        return status == BidStatus::Accepted;
     }
+};
 
-    bool createAuction(const string& itemName, const string& description,double startingPrice, double reservePrice, int durationMinutes) {
-        if (currentUserId.empty()) {
-            cout << "Please login first!" << endl;
-            return false;
+// Descriptive side of an auction, read by listings and details pages but
+// never by bids. Stored apart from AuctionHot so strings stay out of the
+// cache lines the bid path and scans walk.
+struct Item {
+    ItemId id;
+    string name;
+    string description;
+    time_point<steady_clock> startTime;
+    
+    Item(ItemId itemId, const string& itemName, const string& desc)
+        : id(itemId), name(itemName), description(desc), startTime(Clock::now()) {}
+};
+
+// Consistent copy of the changing part of an AuctionHot
+struct AuctionView {
+    UserId leader;
+    double highestBid;
+    uint32_t bidCount;
+    bool isActive;
+    double price; // highest bid, or the starting price before the first bid
+};
+
+// Everything bid validation and listing scans read about an auction, in one
+// cache line. AuctionSystem keeps these in their own array, in ItemId order.
+// Prices, seller and end time are fixed at creation; the rest is written
+// under Auction::lock and atomic so scans may read it without the lock.
+//
+// The changing fields are also covered by a seqlock, so readers that need
+// them to agree (price with leader, say) take a view() instead of a lock.
+// Readers never write the line, so dashboards do not slow bidders down and
+// scale with cores; a reader only retries if a bid lands mid-copy.
+struct alignas(64) AuctionHot {
+    double startingPrice;
+    double reservePrice;
+    time_point<steady_clock> endTime;
+    UserId sellerId;
+    atomic<UserId> leader{NO_ID};
+    atomic<double> highestBid{0.0};
+    atomic<uint32_t> bidCount{0};
+    atomic<bool> isActive{true};
+    atomic<uint32_t> version{0}; // odd while publish() is writing
+    
+    AuctionHot(double startPrice, double reserve, UserId seller, time_point<steady_clock> end)
+        : startingPrice(startPrice), reservePrice(reserve), endTime(end), sellerId(seller) {}
+    
+    // Caller holds the auction's lock, so there is one writer at a time
+    void publish(UserId newLeader, double bid, uint32_t count, bool active) {
+        uint32_t start = version.load(memory_order_relaxed);
+        version.store(start + 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+        leader.store(newLeader, memory_order_relaxed);
+        highestBid.store(bid, memory_order_relaxed);
+        bidCount.store(count, memory_order_relaxed);
+        isActive.store(active, memory_order_relaxed);
+        version.store(start + 2, memory_order_release);
+    }
+    
+    AuctionView view() const {
+        AuctionView copy;
+        while (true) {
+            uint32_t before = version.load(memory_order_acquire);
+            copy.leader = leader.load(memory_order_relaxed);
+            copy.highestBid = highestBid.load(memory_order_relaxed);
+            copy.bidCount = bidCount.load(memory_order_relaxed);
+            copy.isActive = isActive.load(memory_order_relaxed);
+            atomic_thread_fence(memory_order_acquire);
+            if ((before & 1) == 0 && version.load(memory_order_relaxed) == before) {
+                break;
+            }
         }
-        
-        string itemId = generateId();
-        Item item(itemId, itemName, description, startingPrice, reservePrice, currentUserId, durationMinutes);
-        auctions[itemId] = Auction(item);
-        userAuctions[currentUserId].push_back(itemId);
-        
-        cout << "Auction created successfully! Item ID: " << itemId << endl;
-        return true;
+        copy.price = copy.bidCount > 0 ? copy.highestBid : startingPrice;
+        return copy;
+    }
+    
+    bool hasBids() const {
+        return bidCount.load(memory_order_relaxed) > 0;
+    }
+    
+    double currentPrice() const {
+        return hasBids() ? highestBid.load(memory_order_relaxed) : startingPrice;
+    }
+    
+    bool isExpired() const {
+        return isExpired(Clock::now());
+    }
+    
+    bool isExpired(time_point<steady_clock> now) const {
+        return now > endTime;
+    }
+    
+    int getRemainingSeconds() const {
+        return getRemainingSeconds(Clock::now());
+    }
+    
+    int getRemainingSeconds(time_point<steady_clock> now) const {
+        auto remaining = duration_cast<seconds>(endTime - now);
+        return max(0, (int)remaining.count());
     }
+};
 
+static_assert(sizeof(AuctionHot) == 64, "AuctionHot should fill exactly one cache line");
 
-    bool placeBid(const string& itemId, double amount) {
-        if (currentUserId.empty()) {
-            cout << "Please login first!" << endl;
+// A predicate over hot records, evaluated by HotScan
+struct ScanQuery {
+    enum State : uint8_t { Open, Due, Any }; // Open: active and not expired; Due: active and expired
+    State state = Open;
+    steady_clock::rep now = 0;
+    double minPrice = -numeric_limits<double>::infinity();
+    double maxPrice = numeric_limits<double>::infinity();
+    bool reserveMet = false; // only auctions whose current price meets the reserve
+};
+
+// Kernels that evaluate a ScanQuery over a contiguous run of AuctionHot
+// records, four (AVX2) or two (NEON) records per step, with a scalar loop for
+// the tail and for other targets. The AVX2 path is chosen at run time so the
+// binary still runs on older x86 CPUs. Vector paths read the atomic fields
+// with plain loads; scans are snapshots and tolerate a bid landing mid-scan.
+class HotScan {
+private:
+    static_assert(is_standard_layout<AuctionHot>::value, "the vector kernels address fields by offset");
+    
+    static bool matches(const AuctionHot& record, const ScanQuery& query) {
+        if (!record.isActive.load(memory_order_relaxed)) {
             return false;
         }
-        
-        if (auctions.find(itemId) == auctions.end()) {
-            cout << "Auction not found!" << endl;
+        bool expired = record.endTime.time_since_epoch().count() < query.now;
+        if ((query.state == ScanQuery::Open && expired) || (query.state == ScanQuery::Due && !expired)) {
             return false;
         }
+        double price = record.currentPrice();
+        return price >= query.minPrice && price <= query.maxPrice && (!query.reserveMet || price >= record.reservePrice);
+    }
+    
+#if defined(__x86_64__) && defined(__GNUC__)
+    // Match mask of records [0, 4)
+    __attribute__((target("avx2")))
+    static unsigned matchAvx2(const AuctionHot* records, const ScanQuery& query) {
+        const char* base = reinterpret_cast<const char*>(records);
+        const __m256i stride = _mm256_setr_epi64x(0, 64, 128, 192);
+        __m256d start = _mm256_i64gather_pd((const double*)(base + offsetof(AuctionHot, startingPrice)), stride, 1);
+        __m256d reserve = _mm256_i64gather_pd((const double*)(base + offsetof(AuctionHot, reservePrice)), stride, 1);
+        __m256d high = _mm256_i64gather_pd((const double*)(base + offsetof(AuctionHot, highestBid)), stride, 1);
+        __m256i end = _mm256_i64gather_epi64((const long long*)(base + offsetof(AuctionHot, endTime)), stride, 1);
+        // bidCount in the low word, isActive in the next byte, then padding
+        __m256i state = _mm256_i64gather_epi64((const long long*)(base + offsetof(AuctionHot, bidCount)), stride, 1);
         
-        if (!users[currentUserId].canBid(amount)) {
-            cout << "Insufficient balance! Your balance: $" << users[currentUserId].balance << endl;
-            return false;
-        }
+        const __m256i zero = _mm256_setzero_si256();
+        __m256i noBids = _mm256_cmpeq_epi64(_mm256_and_si256(state, _mm256_set1_epi64x(0xFFFFFFFF)), zero);
+        __m256i active = _mm256_andnot_si256(_mm256_cmpeq_epi64(_mm256_and_si256(state, _mm256_set1_epi64x(0xFF00000000)), zero),
+                                             _mm256_set1_epi64x(-1));
+        __m256d price = _mm256_blendv_pd(high, start, _mm256_castsi256_pd(noBids));
+        __m256i expired = _mm256_cmpgt_epi64(_mm256_set1_epi64x(query.now), end);
         
-        if (auctions[itemId].placeBid(currentUserId, amount)) {
-            users[currentUserId].addBidToHistory(itemId);
-            return true;
+        __m256d keep = _mm256_and_pd(_mm256_castsi256_pd(active),
+                                     _mm256_and_pd(_mm256_cmp_pd(price, _mm256_set1_pd(query.minPrice), _CMP_GE_OQ),
+                                                   _mm256_cmp_pd(price, _mm256_set1_pd(query.maxPrice), _CMP_LE_OQ)));
+        if (query.state == ScanQuery::Open) {
+            keep = _mm256_andnot_pd(_mm256_castsi256_pd(expired), keep);
+        } else if (query.state == ScanQuery::Due) {
+            keep = _mm256_and_pd(_mm256_castsi256_pd(expired), keep);
         }
-        return false;
+        if (query.reserveMet) {
+            keep = _mm256_and_pd(keep, _mm256_cmp_pd(price, reserve, _CMP_GE_OQ));
+        }
+        return (unsigned)_mm256_movemask_pd(keep);
     }
-
-
-    void displayActiveAuctions() const {
-        cout << "\n=== Active Auctions ===" << endl;
-        bool hasActive = false;
+    
+    static bool haveAvx2() {
+        static const bool supported = __builtin_cpu_supports("avx2");
+        return supported;
+    }
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+    // Match mask of records [0, 2)
+    static unsigned matchNeon(const AuctionHot* records, const ScanQuery& query) {
+        const AuctionHot& a = records[0];
+        const AuctionHot& b = records[1];
+        float64x2_t start = {a.startingPrice, b.startingPrice};
+        float64x2_t reserve = {a.reservePrice, b.reservePrice};
+        float64x2_t high = {a.highestBid.load(memory_order_relaxed), b.highestBid.load(memory_order_relaxed)};
+        int64x2_t end = {(int64_t)a.endTime.time_since_epoch().count(), (int64_t)b.endTime.time_since_epoch().count()};
+        uint64x2_t hasBids = {a.hasBids() ? ~0ull : 0ull, b.hasBids() ? ~0ull : 0ull};
+        uint64x2_t active = {a.isActive.load(memory_order_relaxed) ? ~0ull : 0ull, b.isActive.load(memory_order_relaxed) ? ~0ull : 0ull};
         
-        for (const auto& pair : auctions) {
-            if (pair.second.isActive()) {
-                hasActive = true;
-                const auto& item = pair.second.getItem();
-                cout << "ID: " << item.id << " | " << item.name << " | Current Price: $" << pair.second.getCurrentPrice()<< " | Time Left: " << item.getRemainingSeconds() << "s" << endl;
-            }
+        float64x2_t price = vbslq_f64(hasBids, high, start);
+        uint64x2_t expired = vcltq_s64(end, vdupq_n_s64((int64_t)query.now));
+        uint64x2_t keep = vandq_u64(active, vandq_u64(vcgeq_f64(price, vdupq_n_f64(query.minPrice)),
+                                                      vcleq_f64(price, vdupq_n_f64(query.maxPrice))));
+        if (query.state == ScanQuery::Open) {
+            keep = vbicq_u64(keep, expired);
+        } else if (query.state == ScanQuery::Due) {
+            keep = vandq_u64(keep, expired);
         }
-        
-        if (!hasActive) {
-            cout << "No active auctions available." << endl;
+        if (query.reserveMet) {
+            keep = vandq_u64(keep, vcgeq_f64(price, reserve));
         }
+        return (unsigned)(vgetq_lane_u64(keep, 0) & 1) | (unsigned)((vgetq_lane_u64(keep, 1) & 1) << 1);
     }
-
-
-    void displayAuctionDetails(const string& itemId) {
-        if (auctions.find(itemId) == auctions.end()) {
-            cout << "Auction not found!" << endl;
-            return;
+#endif
+    
+    // Calls emit(i) for each matching record i in [0, count), in order
+    template <typename Emit>
+    static void scan(const AuctionHot* records, size_t count, const ScanQuery& query, Emit emit) {
+        size_t i = 0;
+#if defined(__x86_64__) && defined(__GNUC__)
+        if (haveAvx2()) {
+            for (; i + 4 <= count; i += 4) {
+                for (unsigned mask = matchAvx2(records + i, query); mask != 0; mask &= mask - 1) {
+                    emit(i + (size_t)__builtin_ctz(mask));
+                }
+            }
         }
-        
-        auctions[itemId].displayAuctionInfo();
-    }
-
-
-    void displayUserProfile() const {
-        if (currentUserId.empty()) {
-            cout << "Please login first!" << endl;
-            return;
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+        for (; i + 2 <= count; i += 2) {
+            unsigned mask = matchNeon(records + i, query);
+            if (mask & 1) emit(i);
+            if (mask & 2) emit(i + 1);
         }
-        
-        const User& user = users.at(currentUserId);
-        cout << "\n=== User Profile ===" << endl;
-        cout << "Username: " << user.username << endl;
-        cout << "Email: " << user.email << endl;
-        cout << "Balance: $" << user.balance << endl;
-        cout << "Bids Placed: " << user.bidHistory.size() << endl;
-        cout << "Items Owned: " << user.ownedItems.size() << endl;
-        cout << "Items Sold: " << user.soldItems.size() << endl;
-        
-        if (!userAuctions.empty() && userAuctions.find(currentUserId) != userAuctions.end()) {
-            cout << "Auctions Created: " << userAuctions.at(currentUserId).size() << endl;
+#endif
+        for (; i < count; i++) {
+            if (matches(records[i], query)) {
+                emit(i);
+            }
         }
     }
+    
+public:
+    // Appends first + i for every matching record i
+    static void select(const AuctionHot* records, size_t count, ItemId first, const ScanQuery& query, vector<ItemId>& out) {
+        scan(records, count, query, [&](size_t i) {
+            out.push_back(first + (ItemId)i);
+        });
+    }
+    
+    static size_t count(const AuctionHot* records, size_t size, const ScanQuery& query) {
+        size_t matched = 0;
+        scan(records, size, query, [&](size_t) {
+            matched++;
+        });
+        return matched;
+    }
+};
+
+// Standing automatic bid held by the current leader: bids for them by
+// `increment` over any challenger, up to `maxAmount`
+struct ProxyBid {
+    UserId bidder = NO_ID;
+    double maxAmount = 0.0;
+    double increment = 0.0;
+    
+    bool active() const {
+        return bidder != NO_ID;
+    }
+};
 
+// Funds an open auction keeps reserved on its leader: the visible price, or
+// the leader's proxy maximum when that is higher
+struct Hold {
+    UserId user = NO_ID;
+    double amount = 0.0;
+    
+    double of(UserId userId) const {
+        return user == userId ? amount : 0.0;
+    }
+};
 
-    void displayBidHistory(const string& itemId) {
-        if (auctions.find(itemId) == auctions.end()) {
-            cout << "Auction not found!" << endl;
-            return;
+// How an auction decides what a bid must beat and what the winner pays. The
+// rules of each format are the policy structs after Auction.
+enum class AuctionFormat : uint8_t {
+    English,          // open ascending bids; the highest pays their bid
+    MinimumIncrement, // English, but each bid must beat the price by `increment`
+    Sealed,           // bids hidden until the end; the highest pays their bid
+    Vickrey,          // sealed; the highest pays the best rival bid
+    Dutch             // the price falls from start to reserve; the first taker pays it
+};
+
+struct AuctionRules {
+    AuctionFormat format = AuctionFormat::English;
+    double increment = 0.0; // MinimumIncrement only
+
+    bool sealed() const {
+        return format == AuctionFormat::Sealed || format == AuctionFormat::Vickrey;
+    }
+};
+
+// Spelled as in batch files: english, increment:<amount>, sealed, vickrey, dutch
+static string formatRules(const AuctionRules& rules) {
+    switch (rules.format) {
+        case AuctionFormat::MinimumIncrement: {
+            ostringstream text;
+            text << "increment:" << rules.increment;
+            return text.str();
+        }
+        case AuctionFormat::Sealed: return "sealed";
+        case AuctionFormat::Vickrey: return "vickrey";
+        case AuctionFormat::Dutch: return "dutch";
+        default: return "english";
+    }
+}
+
+static bool parseRules(const string& text, AuctionRules& rules) {
+    rules = AuctionRules();
+    if (text == "english") {
+        return true;
+    }
+    if (text == "sealed" || text == "vickrey" || text == "dutch") {
+        rules.format = text == "sealed" ? AuctionFormat::Sealed : text == "vickrey" ? AuctionFormat::Vickrey : AuctionFormat::Dutch;
+        return true;
+    }
+    if (text.compare(0, 10, "increment:") == 0) {
+        char* end = nullptr;
+        rules.format = AuctionFormat::MinimumIncrement;
+        rules.increment = strtod(text.c_str() + 10, &end);
+        return end != text.c_str() + 10 && *end == '\0' && rules.increment > 0.0;
+    }
+    return false;
+}
+
+struct EnglishRules;
+
+class Auction {
+private:
+    AuctionHot& hot;
+    // Append-only bid log. placeBid only accepts strictly increasing amounts,
+    // so the log is sorted by amount and back() is the highest bid.
+    PoolVector<Bid> bidLog;
+    // For auctions loaded from a mapped snapshot the log stays in the mapping
+    // until the auction is touched again (see materialize)
+    const Bid* mappedBids = nullptr;
+    size_t mappedBidCount = 0;
+    // Track highest bid per user; for mapped logs built on first use
+    mutable FlatIdMap<double> userHighestBids;
+    mutable bool userBidsBuilt = true;
+    // Kept up to date by placeBid; for mapped logs built on first use
+    mutable TopBidders topBidders;
+    mutable bool topBiddersBuilt = true;
+    // Only the leader can hold a proxy; it is dropped once someone outbids its maximum
+    ProxyBid proxy;
+    // Once the log is in the archive only the final bid stays (see archive)
+    bool archived = false;
+    uint64_t archiveOffset = 0;
+    Bid finalBid{NO_ID, 0.0, time_point<system_clock>()};
+    AuctionRules rules;
+    time_point<steady_clock> openedAt; // Dutch auctions price from here to the end time
+    size_t lastPlaced = 0; // log index of the latest bid placed; see getLastPlaced
+    
+    // Copies a mapped bid log into memory before it is modified
+    void materialize() {
+        if (mappedBids != nullptr) {
+            bidLog.assign(mappedBids, mappedBids + mappedBidCount);
+            mappedBids = nullptr;
+            mappedBidCount = 0;
+        }
+        buildUserBids();
+        buildTopBidders();
+    }
+    
+    void buildUserBids() const {
+        if (!userBidsBuilt) {
+            for (const Bid& bid : bids()) {
+                userHighestBids[bid.bidder] = bid.amount;
+            }
+            userBidsBuilt = true;
+        }
+    }
+    
+    // The log is sorted by amount, so the top bidders are the last distinct
+    // bidders in it and the scan can stop as soon as the table is full
+    void buildTopBidders() const {
+        if (!topBiddersBuilt) {
+            BidSpan log = bids();
+            for (size_t i = log.size(); i > 0 && !topBidders.full(); i--) {
+                topBidders.update(log[i - 1].bidder, log[i - 1].amount);
+            }
+            topBiddersBuilt = true;
+        }
+    }
+    
+    // Files a bid at its rank by amount, the earliest of equal bids last, so
+    // the log stays sorted whatever order sealed bids arrive in
+    size_t insertBid(const Bid& bid) {
+        auto at = lower_bound(bidLog.begin(), bidLog.end(), bid.amount, [](const Bid& entry, double amount) {
+            return entry.amount < amount;
+        });
+        auto inserted = bidLog.insert(at, bid);
+        return inserted - bidLog.begin();
+    }
+    
+    BidSpan bids() const {
+        if (archived) {
+            return BidSpan(&finalBid, 1);
+        }
+        if (mappedBids != nullptr) {
+            return BidSpan(mappedBids, mappedBidCount);
+        }
+        return BidSpan(bidLog.data(), bidLog.size());
+    }
+    
+public:
+    // Guards the item state and bid containers. Auction does not lock itself;
+    // AuctionSystem takes this around every access.
+    mutable mutex lock;
+    // Event feed state, under the same lock: whether the auction waits in the
+    // publish queue, and its leader and bid count when it was queued
+    bool eventQueued = false;
+    UserId eventLeader = NO_ID;
+    uint32_t eventBidCount = 0;
+    // Set while the auction waits for the price index to pick up its new price
+    bool priceQueued = false;
+    
+    explicit Auction(AuctionHot& record) : hot(record) {}
+    
+    // An auction whose bid log lives in a mapped snapshot that outlives it
+    Auction(AuctionHot& record, const Bid* bids, size_t bidCount)
+        : hot(record), mappedBids(bidCount > 0 ? bids : nullptr), mappedBidCount(bidCount),
+          userBidsBuilt(bidCount == 0), topBiddersBuilt(bidCount == 0) {
+        if (bidCount > 0) {
+            noteBid(bids[bidCount - 1].bidder, bids[bidCount - 1].amount, bidCount);
+        }
+    }
+    
+    bool isActive() const {
+        return hot.isActive.load(memory_order_relaxed) && !hot.isExpired();
+    }
+    
+    bool isActive(time_point<steady_clock> now) const {
+        return hot.isActive.load(memory_order_relaxed) && !hot.isExpired(now);
+    }
+    
+    // Set once, right after construction. A sealed auction keeps its bids
+    // out of the hot record until endAuction reveals them.
+    void setRules(const AuctionRules& auctionRules, time_point<steady_clock> opened) {
+        rules = auctionRules;
+        openedAt = opened;
+        if (bidsSealed()) {
+            hot.publish(NO_ID, 0.0, 0, true);
+        }
+    }
+    
+    const AuctionRules& getRules() const {
+        return rules;
+    }
+    
+    time_point<steady_clock> getOpened() const {
+        return openedAt;
+    }
+    
+    // A Dutch auction's asking price: falls linearly from the starting price
+    // at opening to the reserve at the end time, rounded up to the cent.
+    // Rules and end time are fixed, so this needs no lock.
+    double clockPrice(time_point<steady_clock> now) const {
+        double floorPrice = min(hot.reservePrice, hot.startingPrice);
+        double span = duration<double>(hot.endTime - openedAt).count();
+        double elapsed = duration<double>(now - openedAt).count();
+        double fraction = span > 0.0 ? min(1.0, max(0.0, elapsed / span)) : 1.0;
+        double price = hot.startingPrice - (hot.startingPrice - floorPrice) * fraction;
+        return max(floorPrice, ceil(price * 100.0 - 1e-6) / 100.0);
+    }
+    
+    // True while bids, bidders and their number are hidden
+    bool bidsSealed() const {
+        return rules.sealed() && hot.isActive.load(memory_order_relaxed);
+    }
+    
+    // Closes bidding and publishes the outcome; `price` is what the winner
+    // pays under the auction's rules. The per-user index only serves bidding,
+    // so its table goes back to the pool; getUserBids rebuilds it from the
+    // log if asked again.
+    void endAuction(double price) {
+        UserId leader = hasBids() ? getHighestBid().bidder : NO_ID;
+        hot.publish(leader, hasBids() ? price : 0.0, (uint32_t)getBidCount(), false);
+        userHighestBids.release();
+        userBidsBuilt = false;
+    }
+    
+    // Checks shared by plain and proxy bids; Accepted means the bid may
+    // proceed, at the amount in the result
+    template <typename Rules = EnglishRules>
+    BidResult checkBid(UserId userId, double amount) const {
+        if (!isActive()) {
+            return BidResult(BidStatus::AuctionInactive, amount);
         }
         
-        auto bidHistory = auctions[itemId].getBidHistory();
-        cout << "\n=== Bid History for " << itemId << " ===" << endl;
+        BidResult result = Rules::check(*this, userId, amount);
         
-        if (bidHistory.empty()) {
-            cout << "No bids placed yet." << endl;
-            return;
+        // Check if user is trying to bid on their own item
+        if (result.accepted() && userId == hot.sellerId) {
+            return BidResult(BidStatus::OwnItem, amount);
         }
         
-        sort(bidHistory.begin(), bidHistory.end(), [](const Bid& a, const Bid& b) {
-            return a.amount > b.amount; // Sort by amount descending
-        });
+        return result;
+    }
+    
+    // Mirrors the head of the log into the hot record
+    void noteBid(UserId userId, double amount, size_t bidCount) {
+        hot.publish(userId, amount, (uint32_t)bidCount, hot.isActive.load(memory_order_relaxed));
+    }
+    
+    void appendBid(UserId userId, double amount) {
+        materialize();
+        bidLog.emplace_back(userId, amount);
+        lastPlaced = bidLog.size() - 1;
+        noteBid(userId, amount, bidLog.size());
         
-        int rank = 1;
-        for (const auto& bid : bidHistory) {
-            cout << rank++ << ". User: " << bid.userId 
-                 << " | Amount: $" << bid.amount 
-                 << " | Time: " << duration_cast<seconds>(bid.timestamp.time_since_epoch()).count() % 10000 << endl;
+        // Amounts only increase, so this bid is the user's new highest
+        userHighestBids[userId] = amount;
+        topBidders.update(userId, amount);
+    }
+    
+    // If a standing proxy covers `amount`, bids for it and returns true
+    bool defendProxy(UserId challenger, double amount) {
+        if (!proxy.active() || proxy.bidder == challenger) {
+            return false;
         }
+        if (proxy.maxAmount < amount) {
+            proxy = ProxyBid();
+            return false;
+        }
+        // Ties go to the earlier proxy
+        appendBid(proxy.bidder, min(proxy.maxAmount, amount + proxy.increment));
+        return true;
     }
-
-
-    void endAuction(const string& itemId) {
-        if (auctions.find(itemId) == auctions.end()) {
-            cout << "Auction not found!" << endl;
-            return;
+    
+    // Sealed bids go to their rank in the log and nowhere else; a raise
+    // leaves the bidder's earlier bid in the log below it
+    void sealBid(UserId userId, double amount) {
+        materialize();
+        lastPlaced = insertBid(Bid(userId, amount));
+        userHighestBids[userId] = amount;
+        topBidders.update(userId, amount);
+    }
+    
+    template <typename Rules = EnglishRules>
+    BidResult placeBid(UserId userId, double amount) {
+        BidResult result = checkBid<Rules>(userId, amount);
+        if (!result.accepted()) {
+            return result;
         }
         
-        Auction& auction = auctions[itemId];
+        if constexpr (Rules::SEALED) {
+            sealBid(userId, result.amount);
+            return result;
+        }
         
-        if (!auction.isActive()) {
-            cout << "Auction already ended!" << endl;
-            return;
+        if (Rules::PROXIES && defendProxy(userId, amount)) {
+            return BidResult(BidStatus::Outbid, amount, getHighestBid().amount);
+        }
+        
+        appendBid(userId, result.amount);
+        if (Rules::PROXIES && proxy.bidder == userId && proxy.maxAmount <= amount) {
+            proxy = ProxyBid();
+        }
+        return result;
+    }
+    
+    // Bids on the user's behalf up to maxAmount, `increment` above any rival.
+    // A duel between two proxies is settled at once: only the resulting price
+    // is logged, not every step of the bidding war. The leader calling again
+    // raises their maximum without moving the price. Formats without proxies
+    // take a plain bid of maxAmount instead.
+    template <typename Rules = EnglishRules>
+    BidResult placeProxyBid(UserId userId, double maxAmount, double increment) {
+        if constexpr (!Rules::PROXIES) {
+            return placeBid<Rules>(userId, maxAmount);
+        }
+        increment = max(increment, rules.increment);
+        if (proxy.bidder == userId && isActive()) {
+            if (maxAmount <= proxy.maxAmount) {
+                return BidResult(BidStatus::BelowCurrentBid, maxAmount, proxy.maxAmount);
+            }
+            proxy = ProxyBid{userId, maxAmount, increment};
+            return BidResult(BidStatus::Accepted, getCurrentPrice(), getCurrentPrice());
         }
         
-        auction.endAuction();
-        Bid highestBid = auction.getHighestBid();
+        BidResult result = checkBid<Rules>(userId, maxAmount);
+        if (!result.accepted()) {
+            return result;
+        }
         
-        cout << "\n=== Auction Ended ===" << endl;
+        // A rival proxy that loses is driven all the way to its maximum
+        double floor = proxy.active() ? proxy.maxAmount : getCurrentPrice();
+        if (defendProxy(userId, maxAmount)) {
+            return BidResult(BidStatus::Outbid, maxAmount, getHighestBid().amount);
+        }
+        
+        // A leader without a proxy keeps the current price
+        if (!proxy.active() && hasBids() && getHighestBid().bidder == userId) {
+            proxy = ProxyBid{userId, maxAmount, increment};
+            return BidResult(BidStatus::Accepted, getCurrentPrice(), getCurrentPrice());
+        }
         
-        if (highestBid.userId.empty()) {
-            cout << "No bids were placed. Item remains unsold." << endl;
-        } else if (!auction.hasReserveBeenMet()) {
-            cout << "Reserve price not met. Item remains unsold." << endl;
-            cout << "Highest bid: $" << highestBid.amount << " by " << highestBid.userId << endl;
+        double price = min(maxAmount, floor + increment);
+        appendBid(userId, price);
+        proxy = ProxyBid{userId, maxAmount, increment};
+        return BidResult(BidStatus::Accepted, price, price);
+    }
+    
+    const ProxyBid& getProxy() const {
+        return proxy;
+    }
+    
+    // Derived from the bid state, so it needs no storage of its own
+    Hold getHold() const {
+        Hold hold;
+        if (hot.isActive.load(memory_order_relaxed) && hasBids()) {
+            hold.user = getHighestBid().bidder;
+            hold.amount = getHighestBid().amount;
+            if (proxy.bidder == hold.user) {
+                hold.amount = max(hold.amount, proxy.maxAmount);
+            }
+        }
+        return hold;
+    }
+    
+    void restoreProxy(const ProxyBid& restored) {
+        proxy = restored;
+    }
+    
+    // Appends a bid recovered from a snapshot or the WAL, skipping validation
+    void restoreBid(UserId userId, double amount, time_point<system_clock> timestamp) {
+        materialize();
+        if (rules.sealed()) {
+            insertBid(Bid(userId, amount, timestamp));
         } else {
-            cout << "Item sold to " << highestBid.userId << " for $" << highestBid.amount << endl;
-            
-            // Update user records
-            users[highestBid.userId].deductBalance(highestBid.amount);
-            users[highestBid.userId].addOwnedItem(itemId);
-            
-            const auto& item = auction.getItem();
-            users[item.sellerId].addBalance(highestBid.amount);
-            users[item.sellerId].addSoldItem(itemId);
+            bidLog.emplace_back(userId, amount, timestamp);
+            noteBid(userId, amount, bidLog.size());
         }
+        userHighestBids[userId] = amount;
+        topBidders.update(userId, amount);
     }
-
-
-    // Function to add balance to the user's account
-    void addBalance(double amount) {
-        if (currentUserId.empty()) {
-            cout << "Please login first!" << endl;
+    
+    // From the log rather than the hot record, which a sealed auction keeps empty
+    bool hasBids() const {
+        return !bids().empty();
+    }
+    
+    // Only valid when hasBids() is true
+    const Bid& getHighestBid() const {
+        return bids().back();
+    }
+    
+    // The bid the latest placeBid or placeProxyBid added to the log: the
+    // highest one unless the auction is sealed
+    const Bid& getLastPlaced() const {
+        return bids()[lastPlaced];
+    }
+    
+    size_t getBidCount() const {
+        return archived ? hot.bidCount.load(memory_order_relaxed) : bids().size();
+    }
+    
+    double getCurrentPrice() const {
+        return hot.currentPrice();
+    }
+    
+    const AuctionHot& getHot() const {
+        return hot;
+    }
+    
+    // Valid until the next bid on this auction. An archived auction only has
+    // its final bid here; AuctionSystem reads the rest from the archive.
+    BidSpan getBidHistory() const {
+        return bids();
+    }
+    
+    // One page of the history, newest-first ranks [offset, offset + limit)
+    BidSpan getBidHistory(size_t offset, size_t limit) const {
+        return bids().newest(offset, limit);
+    }
+    
+    bool isMapped() const {
+        return mappedBids != nullptr;
+    }
+    
+    // Drops the log of an ended auction that is now stored at `offset` in a
+    // BidArchive. The final bid and the top bidders stay resident; the history
+    // and per-user bids must be read back from the archive.
+    void archive(uint64_t offset) {
+        buildTopBidders();
+        finalBid = bids().back();
+        PoolVector<Bid>().swap(bidLog);
+        userHighestBids.release();
+        userBidsBuilt = true;
+        archiveOffset = offset;
+        archived = true;
+    }
+    
+    bool isArchived() const {
+        return archived;
+    }
+    
+    uint64_t getArchiveOffset() const {
+        return archiveOffset;
+    }
+    
+    const FlatIdMap<double>& getUserBids() const {
+        buildUserBids();
+        return userHighestBids;
+    }
+    
+    // Best bidders first; valid until the next bid on this auction
+    const TopBidders& getTopBidders() const {
+        buildTopBidders();
+        return topBidders;
+    }
+    
+    bool hasReserveBeenMet() const {
+        return hasBids() && getHighestBid().amount >= hot.reservePrice;
+    }
+    
+    // Reads only the hot record, so the caller need not hold lock
+    void displayAuctionInfo(const Item& item, const SymbolTable& itemIds, const SymbolTable& userIds) const {
+        AuctionView view = hot.view();
+        auto now = Clock::now();
+        bool open = view.isActive && !hot.isExpired(now);
+        double price = rules.format == AuctionFormat::Dutch && open && view.bidCount == 0 ? clockPrice(now) : view.price;
+        cout << "\n=== Auction Details ===" << endl;
+        cout << "Item: " << item.name << " (ID: " << itemIds.name(item.id) << ")" << endl;
+        cout << "Description: " << item.description << endl;
+        cout << "Starting Price: $" << hot.startingPrice << endl;
+        cout << "Reserve Price: $" << hot.reservePrice << endl;
+        if (rules.format != AuctionFormat::English) {
+            cout << "Format: " << formatRules(rules) << endl;
+        }
+        cout << "Current Price: $" << price << endl;
+        cout << "Seller: " << userIds.name(hot.sellerId) << endl;
+        cout << "Status: " << (open ? "Active" : "Ended") << endl;
+        cout << "Time Remaining: " << hot.getRemainingSeconds(now) << " seconds" << endl;
+        cout << "Reserve Met: " << (price >= hot.reservePrice ? "Yes" : "No") << endl;
+        if (bidsSealed()) {
+            cout << "Bids are sealed until the auction ends." << endl;
             return;
         }
+        cout << "Total Bids: " << view.bidCount << endl;
         
-        users[currentUserId].addBalance(amount);
-        cout << "Balance added successfully! New balance: $" << users[currentUserId].balance << endl;
+        if (view.bidCount > 0) {
+            cout << "Highest Bidder: " << userIds.name(view.leader) << endl;
+        }
     }
+};
 
+// Bid rules per AuctionFormat. Auction's bid path is a template over one of
+// these, so every format gets its own path with its checks inlined and none
+// of the others' branches; withRules picks the policy from an auction's
+// format, once per bid or per run of bids on the auction.
+struct EnglishRules {
+    static constexpr bool SEALED = false;        // bids stay out of the hot record until the end
+    static constexpr bool PROXIES = true;        // proxy bids, and bursts coalesced highest first
+    static constexpr bool CLOSES_ON_BID = false; // the first accepted bid ends the auction
     
-    void searchAuctions(const string& keyword) const {
-        cout << "\n=== Search Results for: " << keyword << " ===" << endl;
-        bool found = false;
-        
-        for (const auto& pair : auctions) {
-            const auto& item = pair.second.getItem();
-            if (item.name.find(keyword) != string::npos || item.description.find(keyword) != string::npos) {
-                found = true;
-                cout << "ID: " << item.id << " | " << item.name << " | Current Price: $" << pair.second.getCurrentPrice()<< " | Status: " << (pair.second.isActive() ? "Active" : "Ended") << endl;
-            }
+    static BidResult check(const Auction& auction, UserId, double amount) {
+        const AuctionHot& hot = auction.getHot();
+        if (amount <= hot.startingPrice) {
+            return BidResult(BidStatus::BelowStartingPrice, amount, hot.startingPrice);
         }
-        
-        if (!found) {
-            cout << "No auctions found matching: " << keyword << endl;
+        double highest = hot.highestBid.load(memory_order_relaxed);
+        if (hot.hasBids() && amount <= highest) {
+            return BidResult(BidStatus::BelowCurrentBid, amount, highest);
         }
+        return BidResult(BidStatus::Accepted, amount, amount);
     }
+    
+    // What the winner pays; only called once the auction has bids
+    static double salePrice(const Auction& auction) {
+        return auction.getHighestBid().amount;
+    }
+};
 
-    void displayTopBidders(const string& itemId) const {
-        if (auctions.find(itemId) == auctions.end()) {
-            cout << "Auction not found!" << endl;
-            return;
-        }
-        
-        auto userBids = auctions.at(itemId).getUserBids();
-        vector<pair<string, double>> bidders;
-        
-        for (const auto& pair : userBids) {
-            bidders.push_back({pair.first, pair.second});
+struct MinimumIncrementRules : EnglishRules {
+    static BidResult check(const Auction& auction, UserId, double amount) {
+        const AuctionHot& hot = auction.getHot();
+        if (amount <= hot.startingPrice) {
+            return BidResult(BidStatus::BelowStartingPrice, amount, hot.startingPrice);
         }
-        
-        sort(bidders.begin(), bidders.end(), [](const pair<string, double>& a, const pair<string, double>& b) {
-            return a.second > b.second;
-        });
-        
-        cout << "\n=== Top Bidders for " << itemId << " ===" << endl;
-        int rank = 1;
-        for (const auto& bidder : bidders) {
-            cout << rank++ << ". " << bidder.first << " - $" << bidder.second << endl;
-            if (rank > 5) break; // Show top 5 only
+        double needed = hot.highestBid.load(memory_order_relaxed) + auction.getRules().increment;
+        if (hot.hasBids() && amount < needed) {
+            return BidResult(BidStatus::BelowMinimumIncrement, amount, needed);
         }
+        return BidResult(BidStatus::Accepted, amount, amount);
     }
+};
 
+// A bidder sees nothing of the others and may only raise their own bid
+struct SealedRules : EnglishRules {
+    static constexpr bool SEALED = true;
+    static constexpr bool PROXIES = false;
+    
+    static BidResult check(const Auction& auction, UserId userId, double amount) {
+        const AuctionHot& hot = auction.getHot();
+        if (amount <= hot.startingPrice) {
+            return BidResult(BidStatus::BelowStartingPrice, amount, hot.startingPrice);
+        }
+        const double* own = auction.getUserBids().find(userId);
+        if (own != nullptr && amount <= *own) {
+            return BidResult(BidStatus::BelowCurrentBid, amount, *own);
+        }
+        return BidResult(BidStatus::Accepted, amount, amount);
+    }
+};
 
-    void displayMenu() const {
-        cout << "\n=== Auction System Menu ===" << endl;
-        cout << "1. Register User" << endl;
-        cout << "2. Login" << endl;
-        cout << "3. Logout" << endl;
-        cout << "4. Create Auction" << endl;
-        cout << "5. Place Bid" << endl;
-        cout << "6. View Active Auctions" << endl;
-        cout << "7. View Auction Details" << endl;
-        cout << "8. View User Profile" << endl;
-        cout << "9. View Bid History" << endl;
-        cout << "10. End Auction" << endl;
-        cout << "11. Add Balance" << endl;
-        cout << "12. Search Auctions" << endl;
-        cout << "13. View Top Bidders" << endl;
-        cout << "0. Exit" << endl;
-        cout << "Choice: ";
+struct VickreyRules : SealedRules {
+    // The best rival bid, or the starting price without one, but at least
+    // the reserve and never more than the winner bid
+    static double salePrice(const Auction& auction) {
+        const TopBidders& top = auction.getTopBidders();
+        double second = top.size() > 1 ? top.begin()[1].amount : auction.getHot().startingPrice;
+        return min(auction.getHighestBid().amount, max(second, auction.getHot().reservePrice));
     }
+};
 
+// Any bid at or above the clock price takes the item at that price
+struct DutchRules : EnglishRules {
+    static constexpr bool PROXIES = false;
+    static constexpr bool CLOSES_ON_BID = true;
+    
+    static BidResult check(const Auction& auction, UserId, double amount) {
+        if (auction.hasBids()) {
+            return BidResult(BidStatus::AuctionInactive, amount);
+        }
+        double price = auction.clockPrice(Clock::now());
+        if (amount < price) {
+            return BidResult(BidStatus::BelowCurrentBid, amount, price);
+        }
+        return BidResult(BidStatus::Accepted, price, price);
+    }
+};
 
+// Calls fn with a value of the policy type for `format`
+template <typename Fn>
+static auto withRules(AuctionFormat format, Fn fn) {
+    switch (format) {
+        case AuctionFormat::MinimumIncrement: return fn(MinimumIncrementRules());
+        case AuctionFormat::Sealed: return fn(SealedRules());
+        case AuctionFormat::Vickrey: return fn(VickreyRules());
+        case AuctionFormat::Dutch: return fn(DutchRules());
+        default: return fn(EnglishRules());
+    }
+}
 
-    void run() {
-        int choice;
-        string input, username, email, itemName, description, itemId, keyword;
-        double startingPrice, reservePrice, amount;
-        int duration;
-        
-        cout << "Welcome to Advanced Auction System!" << endl;
-        
-        while (true) {
-            displayMenu();
-            cin >> choice;
-            cin.ignore(); // Clear input buffer
-            
-            switch (choice) {
-                case 1:
+class User {
+public:
+    UserId id;
+    string username;
+    string email;
+    double balance;
+    double reserved = 0.0; // held for auctions this user leads; see Hold
+    PoolVector<ItemId> bidHistory;
+    PoolVector<ItemId> ownedItems;
+    PoolVector<ItemId> soldItems;
+    PoolVector<ItemId> createdAuctions;
+    mutable mutex lock; // guards balance, the item lists and the bid tokens
+    // Token bucket for bid admission; full until first used
+    double bidTokens = -1.0;
+    time_point<steady_clock> tokensRefilled;
+    
+    User(UserId userId, const string& uname, const string& mail, double bal = 0.0)
+        : id(userId), username(uname), email(mail), balance(bal) {}
+    
+    // Takes one bid token, refilled at `rate` per second up to `burst`
+    bool takeBidToken(double rate, double burst, time_point<steady_clock> now) {
+        if (bidTokens < 0.0) {
+            bidTokens = burst;
+        } else {
+            bidTokens = min(burst, bidTokens + rate * duration<double>(now - tokensRefilled).count());
+        }
+        tokensRefilled = now;
+        if (bidTokens < 1.0) {
+            return false;
+        }
+        bidTokens -= 1.0;
+        return true;
+    }
+    
+    // Balance not yet promised to an auction
+    double available() const {
+        return balance - reserved;
+    }
+    
+    bool canBid(double amount) const {
+        return available() >= amount;
+    }
+    
+    // Holds are added and removed in different orders, so the float sum can
+    // drift; anything below a millionth is treated as nothing held
+    void adjustReserved(double delta) {
+        reserved += delta;
+        if (reserved < 1e-6) {
+            reserved = 0.0;
+        }
+    }
+    
+    void deductBalance(double amount) {
+        if (balance >= amount) {
+            balance -= amount;
+        }
+    }
+    
+    void addBalance(double amount) {
+        balance += amount;
+    }
+    
+    void addBidToHistory(ItemId itemId) {
+        bidHistory.push_back(itemId);
+    }
+    
+    void addOwnedItem(ItemId itemId) {
+        ownedItems.push_back(itemId);
+    }
+    
+    void addSoldItem(ItemId itemId) {
+        soldItems.push_back(itemId);
+    }
+    
+    void addCreatedAuction(ItemId itemId) {
+        createdAuctions.push_back(itemId);
+    }
+};
+
+
+// Collects everything written to it and only hands it to stdout once a large
+// chunk has built up. The system writes with endl everywhere, so without this
+// every line of output during a batch replay would turn into its own write().
+class BufferedSink : public streambuf {
+private:
+    FILE* out;
+    string buffer;
+    size_t threshold;
+
+protected:
+    int overflow(int c) override {
+        if (c != EOF) {
+            buffer.push_back((char)c);
+        }
+        return c;
+    }
+
+    streamsize xsputn(const char* s, streamsize n) override {
+        buffer.append(s, (size_t)n);
+        return n;
+    }
+
+    int sync() override {
+        if (buffer.size() >= threshold) {
+            flushNow();
+        }
+        return 0;
+    }
+
+public:
+    BufferedSink(FILE* target, size_t flushThreshold = 1 << 16)
+        : out(target), threshold(flushThreshold) {
+        buffer.reserve(flushThreshold * 2);
+    }
+
+    ~BufferedSink() override {
+        flushNow();
+    }
+
+    void flushNow() {
+        if (!buffer.empty()) {
+            fwrite(buffer.data(), 1, buffer.size(), out);
+            fflush(out);
+            buffer.clear();
+        }
+    }
+};
+
+// Discards all output (used for --quiet batch runs)
+class NullSink : public streambuf {
+protected:
+    int overflow(int c) override {
+        return c == EOF ? 0 : c;
+    }
+
+    streamsize xsputn(const char*, streamsize n) override {
+        return n;
+    }
+};
+
+
+// Log-linear latency histogram: values below 16ns are exact, above that each
+// power of two is split into 16 buckets (about 6% resolution). Fixed size,
+// no allocation when recording.
+class LatencyHistogram {
+private:
+    static constexpr int SUB_BITS = 4;
+    static constexpr int SUB_COUNT = 1 << SUB_BITS;
+    static constexpr int BUCKETS = (64 - SUB_BITS + 1) * SUB_COUNT;
+
+    uint64_t counts[BUCKETS] = {};
+    uint64_t total = 0;
+    uint64_t maxValue = 0;
+
+    static int bucketOf(uint64_t value) {
+        if (value < (uint64_t)SUB_COUNT) {
+            return (int)value;
+        }
+        int exponent = 63 - __builtin_clzll(value);
+        int sub = (int)((value >> (exponent - SUB_BITS)) & (SUB_COUNT - 1));
+        return (exponent - SUB_BITS + 1) * SUB_COUNT + sub;
+    }
+
+    static uint64_t lowerBound(int bucket) {
+        if (bucket < SUB_COUNT) {
+            return (uint64_t)bucket;
+        }
+        int exponent = bucket / SUB_COUNT + SUB_BITS - 1;
+        uint64_t sub = (uint64_t)(bucket % SUB_COUNT);
+        return (uint64_t(1) << exponent) | (sub << (exponent - SUB_BITS));
+    }
+
+public:
+    void record(uint64_t nanos) {
+        counts[bucketOf(nanos)]++;
+        total++;
+        maxValue = std::max(maxValue, nanos);
+    }
+
+    void merge(const LatencyHistogram& other) {
+        for (int i = 0; i < BUCKETS; i++) {
+            counts[i] += other.counts[i];
+        }
+        total += other.total;
+        maxValue = std::max(maxValue, other.maxValue);
+    }
+
+    void clear() {
+        *this = LatencyHistogram();
+    }
+
+    uint64_t count() const {
+        return total;
+    }
+
+    uint64_t max() const {
+        return maxValue;
+    }
+
+    // Lower bound of the bucket holding the given quantile (0.0 - 1.0)
+    uint64_t percentile(double quantile) const {
+        if (total == 0) {
+            return 0;
+        }
+        uint64_t rank = (uint64_t)(quantile * (double)(total - 1)) + 1;
+        uint64_t seen = 0;
+        for (int i = 0; i < BUCKETS; i++) {
+            seen += counts[i];
+            if (seen >= rank) {
+                return lowerBound(i);
+            }
+        }
+        return maxValue;
+    }
+
+    template <typename Fn>
+    void forEachBucket(Fn fn) const {
+        for (int i = 0; i < BUCKETS; i++) {
+            if (counts[i] != 0) {
+                fn(lowerBound(i), counts[i]);
+            }
+        }
+    }
+};
+
+enum class BrowseOrder {
+    EndingSoonest,
+    PriceLowest,
+    PriceHighest
+};
+
+// Open auctions whose current price lies in [minPrice, maxPrice], one page at a time
+struct BrowseOptions {
+    double minPrice = 0.0;
+    double maxPrice = numeric_limits<double>::infinity();
+    BrowseOrder order = BrowseOrder::EndingSoonest;
+    size_t offset = 0;
+    size_t limit = 0; // 0 means no limit
+};
+
+struct SearchOptions {
+    bool activeOnly = false;
+    size_t limit = 0; // 0 means no limit
+};
+
+enum class SettlementStatus {
+    NoBids,
+    ReserveNotMet,
+    Sold
+};
+
+struct Settlement {
+    ItemId item;
+    SettlementStatus status;
+    UserId winner; // highest bidder, NO_ID when there were no bids
+    double price;
+    bool taken = false; // closed by a bid that took the item, not by its end time
+};
+
+// Snapshot of an auction's public state, as returned by quoteAuction
+struct AuctionQuote {
+    double price = 0.0;
+    uint32_t bidCount = 0;
+    UserId leader = NO_ID;
+    bool active = false;
+    int remainingSeconds = 0;
+};
+
+enum class AuctionEventKind : uint8_t {
+    PriceChanged, // user is the new leader
+    Outbid,       // user led at the previous publish and no longer does
+    Closed,       // ended without a sale; user is the highest bidder if any
+    Sold          // user won at price
+};
+
+struct AuctionEvent {
+    uint64_t sequence; // 1, 2, ... in publish order; a gap means events were missed
+    ItemId item;
+    AuctionEventKind kind;
+    UserId user;
+    double price;
+    uint32_t bidCount;
+};
+
+// Fixed-size broadcast ring of events. One publisher at a time appends;
+// readers keep their own cursor and never block it or each other. Each slot
+// is a seqlock: a reader copies the slot and keeps the copy only if the
+// slot's sequence did not change meanwhile. A reader that falls more than
+// CAPACITY events behind skips ahead to the oldest event still held.
+class EventRing {
+public:
+    static constexpr size_t CAPACITY = 1 << 16;
+    
+private:
+    static constexpr uint64_t WRITING = ~uint64_t(0);
+    
+    struct Slot {
+        atomic<uint64_t> sequence{0};
+        atomic<ItemId> item{NO_ID};
+        atomic<uint8_t> kind{0};
+        atomic<UserId> user{NO_ID};
+        atomic<double> price{0.0};
+        atomic<uint32_t> bidCount{0};
+    };
+    
+    unique_ptr<Slot[]> slots;
+    atomic<uint64_t> published{0};
+    
+public:
+    EventRing() : slots(new Slot[CAPACITY]) {}
+    
+    uint64_t head() const {
+        return published.load(memory_order_acquire);
+    }
+    
+    // Callers serialize publishing among themselves
+    void publish(const AuctionEvent& event) {
+        uint64_t sequence = published.load(memory_order_relaxed) + 1;
+        Slot& slot = slots[sequence & (CAPACITY - 1)];
+        slot.sequence.store(WRITING, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+        slot.item.store(event.item, memory_order_relaxed);
+        slot.kind.store((uint8_t)event.kind, memory_order_relaxed);
+        slot.user.store(event.user, memory_order_relaxed);
+        slot.price.store(event.price, memory_order_relaxed);
+        slot.bidCount.store(event.bidCount, memory_order_relaxed);
+        slot.sequence.store(sequence, memory_order_release);
+        published.store(sequence, memory_order_release);
+    }
+    
+    // Appends up to `limit` events after `cursor` (the last sequence read) to
+    // out and advances cursor. Returns how many events were lost to overrun.
+    uint64_t read(uint64_t& cursor, vector<AuctionEvent>& out, size_t limit) const {
+        uint64_t latest = head();
+        uint64_t missed = 0;
+        for (size_t taken = 0; taken < limit && cursor < latest; ) {
+            uint64_t sequence = cursor + 1;
+            const Slot& slot = slots[sequence & (CAPACITY - 1)];
+            uint64_t before = slot.sequence.load(memory_order_acquire);
+            AuctionEvent event;
+            event.sequence = sequence;
+            event.item = slot.item.load(memory_order_relaxed);
+            event.kind = (AuctionEventKind)slot.kind.load(memory_order_relaxed);
+            event.user = slot.user.load(memory_order_relaxed);
+            event.price = slot.price.load(memory_order_relaxed);
+            event.bidCount = slot.bidCount.load(memory_order_relaxed);
+            atomic_thread_fence(memory_order_acquire);
+            if (before != sequence || slot.sequence.load(memory_order_relaxed) != sequence) {
+                // Overwritten by a later lap: skip to half a ring behind the
+                // writer so the next reads are not overtaken again at once
+                latest = head();
+                uint64_t oldest = latest - min<uint64_t>(latest, CAPACITY / 2);
+                missed += oldest - cursor;
+                cursor = oldest;
+                continue;
+            }
+            out.push_back(event);
+            cursor = sequence;
+            taken++;
+        }
+        return missed;
+    }
+};
+
+// Totals over a batch of settlements, for reporting a bulk close in one go
+struct SettlementSummary {
+    size_t closed = 0;
+    size_t sold = 0;
+    size_t reserveNotMet = 0;
+    size_t noBids = 0;
+    double revenue = 0.0;
+    
+    void add(const Settlement& settlement) {
+        closed++;
+        switch (settlement.status) {
+            case SettlementStatus::NoBids:
+                noBids++;
+                break;
+            case SettlementStatus::ReserveNotMet:
+                reserveNotMet++;
+                break;
+            case SettlementStatus::Sold:
+                sold++;
+                revenue += settlement.price;
+                break;
+        }
+    }
+};
+
+enum class ReportMode {
+    Immediate, // render each result as soon as it is produced
+    Buffered,  // keep results and render them in one go when the buffer fills
+    Silent     // drop results
+};
+
+// Turns bid results into text. Kept out of Auction/AuctionSystem::placeBid so
+// the bid path itself never formats or flushes anything.
+class BidReporter {
+private:
+    ReportMode mode;
+    ostream* out;
+    vector<BidResult> pending;
+    size_t capacity;
+    mutex lock;
+
+    void flushLocked() {
+        if (pending.empty()) {
+            return;
+        }
+        string text;
+        text.reserve(pending.size() * 48);
+        ostringstream line;
+        for (const auto& result : pending) {
+            line.str("");
+            render(line, result);
+            text += line.str();
+            text += '\n';
+        }
+        out->write(text.data(), (streamsize)text.size());
+        out->flush();
+        pending.clear();
+    }
+
+public:
+    BidReporter(ReportMode reportMode = ReportMode::Immediate, ostream* target = &cout, size_t bufferCapacity = 4096)
+        : mode(reportMode), out(target), capacity(bufferCapacity) {}
+
+    ~BidReporter() {
+        flush();
+    }
+
+    void setMode(ReportMode reportMode) {
+        flush();
+        mode = reportMode;
+    }
+
+    void setOutput(ostream* target) {
+        flush();
+        out = target;
+    }
+
+    ReportMode getMode() const {
+        return mode;
+    }
+
+    void report(const BidResult& result) {
+        if (mode == ReportMode::Silent) {
+            return;
+        }
+        lock_guard<mutex> guard(lock);
+        if (mode == ReportMode::Immediate) {
+            render(*out, result);
+            *out << endl;
+            return;
+        }
+        pending.push_back(result);
+        if (pending.size() >= capacity) {
+            flushLocked();
+        }
+    }
+
+    void flush() {
+        lock_guard<mutex> guard(lock);
+        flushLocked();
+    }
+
+    static void render(ostream& os, const BidResult& result) {
+        switch (result.status) {
+            case BidStatus::Accepted:
+                os << "Bid placed successfully! Current highest bid: $" << result.amount;
+                break;
+            case BidStatus::NotLoggedIn:
+                os << "Please login first!";
+                break;
+            case BidStatus::AuctionNotFound:
+                os << "Auction not found!";
+                break;
+            case BidStatus::AuctionInactive:
+                os << "Auction is not active!";
+                break;
+            case BidStatus::BelowStartingPrice:
+                os << "Bid must be higher than starting price: $" << result.reference;
+                break;
+            case BidStatus::BelowCurrentBid:
+                os << "Bid must be higher than current highest bid: $" << result.reference;
+                break;
+            case BidStatus::OwnItem:
+                os << "Cannot bid on your own item!";
+                break;
+            case BidStatus::InsufficientBalance:
+                os << "Insufficient balance! Available: $" << result.reference;
+                break;
+            case BidStatus::Outbid:
+                os << "You were outbid by an automatic bid. Current highest bid: $" << result.reference;
+                break;
+            case BidStatus::RateLimited:
+                os << "Too many bids, please slow down! Limit: " << result.reference << " bids per second";
+                break;
+            case BidStatus::Overloaded:
+                os << "The auction is busy, please try again!";
+                break;
+            case BidStatus::BelowMinimumIncrement:
+                os << "Bid must be at least $" << result.reference;
+                break;
+        }
+    }
+};
+
+
+// Operations timed by Metrics
+enum class MetricOp {
+    PlaceBid,
+    CreateAuction,
+    Search,
+    EndAuction
+};
+
+#ifdef AUCTION_METRICS
+// Counters and latency histograms for the hot paths, compiled in with
+// -DAUCTION_METRICS. Each thread records into one of a fixed set of stripes,
+// so the stripe lock is practically uncontended; readers merge the stripes.
+class Metrics {
+public:
+    static constexpr size_t OP_COUNT = (size_t)MetricOp::EndAuction + 1;
+    static constexpr size_t STATUS_COUNT = (size_t)BidStatus::BelowMinimumIncrement + 1;
+    static constexpr size_t SETTLEMENT_COUNT = (size_t)SettlementStatus::Sold + 1;
+    
+    struct Totals {
+        uint64_t bids[STATUS_COUNT] = {};
+        uint64_t settlements[SETTLEMENT_COUNT] = {};
+        LatencyHistogram latency[OP_COUNT];
+        uint64_t latencySum[OP_COUNT] = {}; // nanoseconds
+    };
+    
+private:
+    static constexpr size_t STRIPES = 16;
+    
+    struct alignas(64) Stripe {
+        mutex lock;
+        Totals totals;
+    };
+    
+    unique_ptr<Stripe[]> stripes{new Stripe[STRIPES]};
+    
+    Stripe& local() {
+        static atomic<size_t> nextStripe{0};
+        static thread_local size_t index = nextStripe.fetch_add(1, memory_order_relaxed) % STRIPES;
+        return stripes[index];
+    }
+    
+public:
+    void recordBid(BidStatus status, uint64_t nanos) {
+        Stripe& stripe = local();
+        lock_guard<mutex> guard(stripe.lock);
+        stripe.totals.bids[(size_t)status]++;
+        stripe.totals.latency[(size_t)MetricOp::PlaceBid].record(nanos);
+        stripe.totals.latencySum[(size_t)MetricOp::PlaceBid] += nanos;
+    }
+    
+    void record(MetricOp op, uint64_t nanos) {
+        Stripe& stripe = local();
+        lock_guard<mutex> guard(stripe.lock);
+        stripe.totals.latency[(size_t)op].record(nanos);
+        stripe.totals.latencySum[(size_t)op] += nanos;
+    }
+    
+    void recordSettlement(SettlementStatus status, size_t count = 1) {
+        Stripe& stripe = local();
+        lock_guard<mutex> guard(stripe.lock);
+        stripe.totals.settlements[(size_t)status] += count;
+    }
+    
+    void collect(Totals& totals) {
+        for (size_t i = 0; i < STRIPES; i++) {
+            lock_guard<mutex> guard(stripes[i].lock);
+            const Totals& stripe = stripes[i].totals;
+            for (size_t s = 0; s < STATUS_COUNT; s++) {
+                totals.bids[s] += stripe.bids[s];
+            }
+            for (size_t s = 0; s < SETTLEMENT_COUNT; s++) {
+                totals.settlements[s] += stripe.settlements[s];
+            }
+            for (size_t op = 0; op < OP_COUNT; op++) {
+                totals.latency[op].merge(stripe.latency[op]);
+                totals.latencySum[op] += stripe.latencySum[op];
+            }
+        }
+    }
+    
+    static const char* opName(size_t op) {
+        static const char* const names[OP_COUNT] = {"place_bid", "create_auction", "search", "end_auction"};
+        return names[op];
+    }
+    
+    static const char* statusName(size_t status) {
+        static const char* const names[STATUS_COUNT] = {
+            "accepted", "not_logged_in", "auction_not_found", "auction_inactive", "below_starting_price",
+            "below_current_bid", "own_item", "insufficient_balance", "outbid",
+            "rate_limited", "overloaded", "below_minimum_increment"};
+        return names[status];
+    }
+    
+    static const char* settlementName(size_t status) {
+        static const char* const names[SETTLEMENT_COUNT] = {"no_bids", "reserve_not_met", "sold"};
+        return names[status];
+    }
+};
+#endif
+
+
+// A bid addressed to one auction, as queued for a shard worker
+struct BidCommand {
+    Session session;
+    ItemId itemId;
+    double amount;
+    uint64_t tag; // caller's correlation value, handed back on completion
+    promise<BidResult>* reply; // set for synchronous calls, otherwise nullptr
+    bool proxy = false; // amount is a proxy maximum (see Auction::placeProxyBid)
+};
+
+// Partitions auctions by item ID hash across worker threads. Each shard has
+// exactly one worker, which is the only thread that ever writes the auctions
+// of that shard, so bids on different shards never contend and bids on the
+// same shard are applied in arrival order without fighting over a lock.
+//
+// Producers append to a shard's inbox under a short lock; the worker swaps
+// the whole inbox out and processes it as one batch, so the queue lock is
+// taken once per batch rather than once per bid.
+class ShardedBidEngine {
+public:
+    // Applies a batch of commands that all belong to `shard`, filling one result per command
+    using BatchHandler = function<void(size_t shard, const vector<BidCommand>& batch, vector<BidResult>& results)>;
+    // Called on the worker thread for every asynchronous command, or on the
+    // submitting thread for one turned away by a full queue
+    using Completion = function<void(const BidCommand& command, const BidResult& result)>;
+
+private:
+    struct Shard {
+        mutex queueLock;
+        condition_variable ready;
+        condition_variable idle;
+        vector<BidCommand> inbox;
+        size_t inFlight = 0; // queued or being processed
+        bool stopping = false;
+        thread worker;
+    };
+
+    vector<unique_ptr<Shard>> shards;
+    BatchHandler handler;
+    Completion completion;
+    atomic<size_t> queueLimit{0}; // per shard; 0 means unbounded
+
+    void workerLoop(size_t index) {
+        Shard& shard = *shards[index];
+        vector<BidCommand> batch;
+        vector<BidResult> results;
+        while (true) {
+            {
+                unique_lock<mutex> guard(shard.queueLock);
+                shard.ready.wait(guard, [&] { return shard.stopping || !shard.inbox.empty(); });
+                if (shard.inbox.empty()) {
+                    return; // stopping and drained
+                }
+                batch.swap(shard.inbox);
+            }
+
+            results.clear();
+            handler(index, batch, results);
+            for (size_t i = 0; i < batch.size(); i++) {
+                complete(batch[i], results[i]);
+            }
+
+            {
+                lock_guard<mutex> guard(shard.queueLock);
+                shard.inFlight -= batch.size();
+                if (shard.inFlight == 0) {
+                    shard.idle.notify_all();
+                }
+            }
+            batch.clear();
+        }
+    }
+
+    static void pinToCpu(thread& worker, size_t cpu) {
+#ifdef __linux__
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu % CPU_SETSIZE, &cpus);
+        pthread_setaffinity_np(worker.native_handle(), sizeof(cpus), &cpus);
+#else
+        (void)worker;
+        (void)cpu;
+#endif
+    }
+
+public:
+    ShardedBidEngine(size_t shardCount, BatchHandler batchHandler, Completion onComplete = nullptr, bool pinThreads = false)
+        : handler(std::move(batchHandler)), completion(std::move(onComplete)) {
+        shardCount = max<size_t>(1, shardCount);
+        size_t cpus = max(1u, thread::hardware_concurrency());
+        for (size_t i = 0; i < shardCount; i++) {
+            shards.push_back(make_unique<Shard>());
+        }
+        for (size_t i = 0; i < shardCount; i++) {
+            shards[i]->worker = thread(&ShardedBidEngine::workerLoop, this, i);
+            if (pinThreads) {
+                pinToCpu(shards[i]->worker, i % cpus);
+            }
+        }
+    }
+
+    ShardedBidEngine(const ShardedBidEngine&) = delete;
+    ShardedBidEngine& operator=(const ShardedBidEngine&) = delete;
+
+    ~ShardedBidEngine() {
+        for (auto& shard : shards) {
+            lock_guard<mutex> guard(shard->queueLock);
+            shard->stopping = true;
+            shard->ready.notify_one();
+        }
+        for (auto& shard : shards) {
+            shard->worker.join();
+        }
+    }
+
+    size_t shardCount() const {
+        return shards.size();
+    }
+
+    size_t shardOf(ItemId itemId) const {
+        return ((uint64_t)itemId * 2654435761u >> 16) % shards.size();
+    }
+
+    // Delivers a result the way a worker does: to the caller waiting on the
+    // command, or else to the completion callback
+    void complete(const BidCommand& command, const BidResult& result) {
+        if (command.reply != nullptr) {
+            command.reply->set_value(result);
+        } else if (completion) {
+            completion(command, result);
+        }
+    }
+
+    // Bounds the commands each shard holds. Past the limit new commands are
+    // answered Overloaded at once, so a burst cannot queue without bound.
+    void setQueueLimit(size_t limit) {
+        queueLimit = limit;
+    }
+
+    // Queues a bid; the result is delivered to the completion callback.
+    // Returns false if the shard was full and the bid was turned away.
+    bool submit(const BidCommand& command) {
+        Shard& shard = *shards[shardOf(command.itemId)];
+        {
+            lock_guard<mutex> guard(shard.queueLock);
+            size_t limit = queueLimit.load(memory_order_relaxed);
+            if (limit == 0 || shard.inFlight < limit) {
+                shard.inbox.push_back(command);
+                shard.inFlight++;
+                if (shard.inbox.size() == 1) {
+                    shard.ready.notify_one();
+                }
+                return true;
+            }
+        }
+        complete(command, BidResult(BidStatus::Overloaded, command.amount));
+        return false;
+    }
+
+    // Queues a bid and waits for the owning shard to apply it
+    BidResult call(const Session& session, ItemId itemId, double amount, bool proxy = false) {
+        promise<BidResult> reply;
+        future<BidResult> result = reply.get_future();
+        submit(BidCommand{session, itemId, amount, 0, &reply, proxy});
+        return result.get();
+    }
+
+    // Blocks until every command submitted so far has been applied
+    void drain() {
+        for (auto& shard : shards) {
+            unique_lock<mutex> guard(shard->queueLock);
+            shard->idle.wait(guard, [&] { return shard->inFlight == 0; });
+        }
+    }
+};
+
+// Little helpers for the binary persistence formats (host byte order)
+class BinaryWriter {
+private:
+    string data;
+
+public:
+    template <typename T>
+    void put(const T& value) {
+        static_assert(is_trivially_copyable<T>::value, "put() needs a plain value");
+        data.append(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    void putString(const string& value) {
+        put((uint32_t)value.size());
+        data.append(value);
+    }
+
+    const string& str() const {
+        return data;
+    }
+
+    void clear() {
+        data.clear();
+    }
+};
+
+class BinaryReader {
+private:
+    const char* pos;
+    const char* end;
+    bool valid = true;
+
+public:
+    BinaryReader(const char* begin, size_t size) : pos(begin), end(begin + size) {}
+
+    template <typename T>
+    T get() {
+        T value{};
+        if ((size_t)(end - pos) < sizeof(T)) {
+            valid = false;
+            pos = end;
+            return value;
+        }
+        memcpy(&value, pos, sizeof(T));
+        pos += sizeof(T);
+        return value;
+    }
+
+    string getString() {
+        uint32_t size = get<uint32_t>();
+        if ((size_t)(end - pos) < size) {
+            valid = false;
+            pos = end;
+            return string();
+        }
+        string value(pos, size);
+        pos += size;
+        return value;
+    }
+
+    bool ok() const {
+        return valid;
+    }
+
+    bool atEnd() const {
+        return pos == end;
+    }
+};
+
+static uint32_t crc32(const char* data, size_t size) {
+    static uint32_t table[256];
+    static bool ready = [] {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            table[i] = c;
+        }
+        return true;
+    }();
+    (void)ready;
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < size; i++) {
+        crc = table[(crc ^ (uint8_t)data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+// Converts between the in-memory steady_clock times and wall-clock
+// milliseconds, which is what gets persisted so times survive a restart
+static int64_t toWallMillis(time_point<steady_clock> t) {
+    auto wall = Clock::wallNow() + duration_cast<system_clock::duration>(t - Clock::now());
+    return duration_cast<milliseconds>(wall.time_since_epoch()).count();
+}
+
+static time_point<steady_clock> fromWallMillis(int64_t millis) {
+    auto wall = time_point<system_clock>(milliseconds(millis));
+    return Clock::now() + duration_cast<steady_clock::duration>(wall - Clock::wallNow());
+}
+
+static int64_t toWallNanos(time_point<system_clock> t) {
+    return duration_cast<nanoseconds>(t.time_since_epoch()).count();
+}
+
+static time_point<system_clock> fromWallNanos(int64_t nanos) {
+    return time_point<system_clock>(duration_cast<system_clock::duration>(nanoseconds(nanos)));
+}
+
+enum class WalRecordType : uint8_t {
+    RegisterUser = 1,
+    CreateAuction = 2,
+    Bid = 3,
+    Settle = 4,
+    AddBalance = 5,
+    Proxy = 6
+};
+
+// Append-only log of accepted state changes with group commit.
+//
+// File layout: "AWAL" magic, u32 version, u64 generation, then records of
+// u32 payload length, u32 CRC-32 of the payload, payload (u8 type + fields).
+// A torn or corrupt tail is ignored on replay and cut off on reopen.
+//
+// append() only copies the record into a buffer. A flusher thread writes
+// the buffer and fdatasyncs it every commit interval (or sooner once the
+// buffer grows large), so many records share one sync and the caller never
+// waits on the disk. sync() blocks until everything appended so far is durable.
+// Each durable batch can also be handed to a shipper, which is how records
+// reach followers (see AuctionSystem's replication section).
+class WriteAheadLog {
+private:
+    static constexpr uint32_t MAGIC = 0x4C415741; // "AWAL"
+    static constexpr uint32_t VERSION = 1;
+    static constexpr size_t HEADER_SIZE = 16;
+
+    int fd = -1;
+    mutex bufferLock;
+    condition_variable wake;
+    condition_variable durable;
+    string buffer;
+    uint64_t appendedBytes = 0;
+    uint64_t durableBytes = 0;
+    bool stopping = false;
+    bool failed = false; // a write or sync failed; sticky until reopened
+    milliseconds commitInterval;
+    size_t flushThreshold;
+    thread flusher;
+    function<void(const string&)> shipper; // under bufferLock
+
+    void flusherLoop() {
+        string writing;
+        unique_lock<mutex> guard(bufferLock);
+        while (true) {
+            wake.wait_for(guard, commitInterval, [&] { return stopping || buffer.size() >= flushThreshold; });
+            if (buffer.empty()) {
+                if (stopping) {
+                    return;
+                }
+                continue;
+            }
+            writing.swap(buffer);
+            uint64_t target = appendedBytes;
+            function<void(const string&)> ship = shipper;
+            guard.unlock();
+
+            // After a failure the file may end in a torn record, so nothing
+            // more is written to it until the log is reopened
+            bool written = !failed && writeAll(writing);
+            if (written && ::fdatasync(fd) != 0) {
+                cerr << "WAL sync failed: " << strerror(errno) << endl;
+                written = false;
+            }
+            if (written && ship) {
+                ship(writing);
+            }
+            writing.clear();
+
+            guard.lock();
+            if (written) {
+                durableBytes = target;
+            } else {
+                failed = true;
+            }
+            durable.notify_all();
+        }
+    }
+
+    bool writeAll(const string& data) {
+        const char* p = data.data();
+        size_t left = data.size();
+        while (left > 0) {
+            ssize_t written = ::write(fd, p, left);
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                cerr << "WAL write failed: " << strerror(errno) << endl;
+                return false;
+            }
+            p += written;
+            left -= (size_t)written;
+        }
+        return true;
+    }
+
+public:
+    WriteAheadLog(milliseconds interval = milliseconds(2), size_t threshold = 1 << 20)
+        : commitInterval(interval), flushThreshold(threshold) {}
+
+    WriteAheadLog(const WriteAheadLog&) = delete;
+    WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+
+    ~WriteAheadLog() {
+        close();
+    }
+
+    // Opens the log for appending. With `reset` (or when the file is missing
+    // or belongs to another generation) the file is recreated empty;
+    // otherwise it is truncated to `validSize`, the end of its last good record.
+    bool open(const string& path, uint64_t generation, bool reset, uint64_t validSize = 0) {
+        close();
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd < 0) {
+            cerr << "Cannot open WAL " << path << ": " << strerror(errno) << endl;
+            return false;
+        }
+        if (reset || validSize < HEADER_SIZE) {
+            BinaryWriter header;
+            header.put(MAGIC);
+            header.put(VERSION);
+            header.put(generation);
+            if (::ftruncate(fd, 0) != 0 || ::pwrite(fd, header.str().data(), HEADER_SIZE, 0) != (ssize_t)HEADER_SIZE) {
+                cerr << "Cannot initialize WAL " << path << endl;
+                return false;
+            }
+            validSize = HEADER_SIZE;
+        } else if (::ftruncate(fd, (off_t)validSize) != 0) {
+            cerr << "Cannot truncate WAL " << path << endl;
+            return false;
+        }
+        ::lseek(fd, (off_t)validSize, SEEK_SET);
+        ::fdatasync(fd);
+
+        stopping = false;
+        failed = false;
+        durableBytes = appendedBytes;
+        flusher = thread(&WriteAheadLog::flusherLoop, this);
+        return true;
+    }
+
+    bool isOpen() const {
+        return fd >= 0;
+    }
+
+    // Called on the flusher thread with every batch of records, in log
+    // order, once the batch is on disk. Stays set across reopens.
+    void setShipper(function<void(const string&)> fn) {
+        lock_guard<mutex> guard(bufferLock);
+        shipper = move(fn);
+    }
+
+    void append(WalRecordType type, const BinaryWriter& fields) {
+        const string& body = fields.str();
+        uint32_t length = (uint32_t)(body.size() + 1);
+        char typeByte = (char)type;
+
+        string payload;
+        payload.reserve(length);
+        payload.push_back(typeByte);
+        payload.append(body);
+        uint32_t checksum = crc32(payload.data(), payload.size());
+
+        lock_guard<mutex> guard(bufferLock);
+        buffer.append(reinterpret_cast<const char*>(&length), sizeof(length));
+        buffer.append(reinterpret_cast<const char*>(&checksum), sizeof(checksum));
+        buffer.append(payload);
+        appendedBytes += sizeof(length) + sizeof(checksum) + payload.size();
+        if (buffer.size() >= flushThreshold) {
+            wake.notify_one();
+        }
+    }
+
+    // Waits until every record appended before this call is on disk.
+    // False if the log failed first, in which case those records never will be.
+    bool sync() {
+        unique_lock<mutex> guard(bufferLock);
+        uint64_t target = appendedBytes;
+        wake.notify_one();
+        durable.wait(guard, [&] { return durableBytes >= target || failed || fd < 0; });
+        return durableBytes >= target;
+    }
+
+    bool hasFailed() {
+        lock_guard<mutex> guard(bufferLock);
+        return failed;
+    }
+
+    void close() {
+        if (fd < 0) {
+            return;
+        }
+        {
+            lock_guard<mutex> guard(bufferLock);
+            stopping = true;
+            wake.notify_one();
+        }
+        flusher.join();
+        ::close(fd);
+        fd = -1;
+    }
+
+    // Calls fn(type, reader) for every intact record of the given generation.
+    // Returns false if the file is missing or from another generation;
+    // validSize receives the offset just past the last good record.
+    template <typename Fn>
+    static bool replay(const string& path, uint64_t generation, uint64_t& validSize, Fn fn) {
+        validSize = 0;
+        ifstream in(path, ios::binary);
+        if (!in) {
+            return false;
+        }
+        string contents((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+        BinaryReader header(contents.data(), min(contents.size(), HEADER_SIZE));
+        uint32_t magic = header.get<uint32_t>();
+        uint32_t version = header.get<uint32_t>();
+        uint64_t fileGeneration = header.get<uint64_t>();
+        if (!header.ok() || magic != MAGIC || version != VERSION || fileGeneration != generation) {
+            return false;
+        }
+
+        validSize = HEADER_SIZE + parse(contents.data() + HEADER_SIZE, contents.size() - HEADER_SIZE, fn);
+        return true;
+    }
+
+    // Calls fn(type, reader) for each intact record at the start of `data`,
+    // in the framing the file uses after its header. Stops at the first torn
+    // or corrupt record and returns the bytes consumed.
+    template <typename Fn>
+    static size_t parse(const char* data, size_t size, Fn fn) {
+        size_t offset = 0;
+        while (size - offset >= 8) {
+            uint32_t length, checksum;
+            memcpy(&length, data + offset, 4);
+            memcpy(&checksum, data + offset + 4, 4);
+            if (length == 0 || size - offset - 8 < length) {
+                break; // torn tail
+            }
+            const char* payload = data + offset + 8;
+            if (crc32(payload, length) != checksum) {
+                break;
+            }
+            BinaryReader fields(payload + 1, length - 1);
+            fn((WalRecordType)payload[0], fields);
+            offset += 8 + length;
+        }
+        return offset;
+    }
+};
+
+// Snapshot file layout (version 5). Every table is a flat array of the POD
+// records below, so a snapshot can be mapped and read in place. Offsets in the
+// header are absolute; offsets inside records index the pool they refer to.
+//   header | users | auctions | terms | id lists | postings | strings | bids
+// metadataCrc covers users through strings. The bid section is left out so
+// that loading never has to touch it; bid logs are paged in on first use.
+struct SnapshotString {
+    uint64_t offset;
+    uint32_t size;
+    uint32_t reserved;
+};
+
+struct SnapshotHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t generation;
+    int32_t nextDisplayId;
+    uint32_t userCount;
+    uint32_t auctionCount;
+    uint32_t termCount;
+    uint64_t usersOffset;
+    uint64_t auctionsOffset;
+    uint64_t termsOffset;
+    uint64_t idsOffset;
+    uint64_t postingsOffset;
+    uint64_t stringsOffset;
+    uint64_t bidsOffset;
+    uint64_t fileSize;
+    uint32_t metadataCrc;
+    uint32_t reserved;
+};
+
+struct SnapshotUser {
+    SnapshotString displayId;
+    SnapshotString username;
+    SnapshotString email;
+    double balance;
+    double reserved;
+    uint64_t listIndex; // bid history, owned, sold, then created items, back to back
+    uint32_t bidCount;
+    uint32_t ownedCount;
+    uint32_t soldCount;
+    uint32_t createdCount;
+};
+
+struct SnapshotAuction {
+    SnapshotString displayId;
+    SnapshotString name;
+    SnapshotString description;
+    double startingPrice;
+    double reservePrice;
+    int64_t startWall;
+    int64_t endWall;
+    uint64_t bidIndex;
+    uint32_t bidCount;
+    UserId sellerId;
+    uint32_t active;
+    UserId proxyBidder;
+    double proxyMax;
+    double proxyIncrement;
+    double ruleIncrement;
+    uint32_t format; // AuctionFormat
+    uint32_t reserved;
+};
+
+struct SnapshotTerm {
+    SnapshotString term;
+    uint64_t postingsIndex;
+    uint32_t postingsCount;
+    uint32_t reserved;
+};
+
+static_assert(sizeof(SnapshotHeader) % 8 == 0 && sizeof(SnapshotUser) % 8 == 0 &&
+              sizeof(SnapshotAuction) % 8 == 0 && sizeof(SnapshotTerm) % 8 == 0,
+              "snapshot records must keep the tables 8-byte aligned");
+
+// Read-only private mapping of a snapshot file. Auctions restored from it point
+// straight into the mapping, so it is kept for the life of the process; a later
+// checkpoint renames a new file over the path, which leaves this inode intact.
+class MappedSnapshot {
+private:
+    const char* base = nullptr;
+    size_t length = 0;
+    
+public:
+    MappedSnapshot() = default;
+    MappedSnapshot(const MappedSnapshot&) = delete;
+    MappedSnapshot& operator=(const MappedSnapshot&) = delete;
+    
+    ~MappedSnapshot() {
+        if (base != nullptr) {
+            munmap((void*)base, length);
+        }
+    }
+    
+    bool open(const string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(SnapshotHeader)) {
+            ::close(fd);
+            return false;
+        }
+        void* mapped = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (mapped == MAP_FAILED) {
+            return false;
+        }
+        base = (const char*)mapped;
+        length = (size_t)info.st_size;
+        return true;
+    }
+    
+    const char* data() const {
+        return base;
+    }
+    
+    size_t size() const {
+        return length;
+    }
+    
+    // `count` records of T at `offset`, or null if they fall outside the file or are misaligned
+    template<typename T>
+    const T* at(uint64_t offset, uint64_t count) const {
+        if (offset > length || count > (length - offset) / sizeof(T) || offset % alignof(T) != 0) {
+            return nullptr;
+        }
+        return reinterpret_cast<const T*>(base + offset);
+    }
+};
+
+// Append-only spill file for the bid logs of settled auctions. Logs are
+// stored verbatim and read back a page at a time, so an archived auction
+// keeps only its final bid in memory. Everything in it can be rebuilt from
+// the snapshot and WAL, so it is truncated when opened and never synced.
+class BidArchive {
+private:
+    int fd = -1;
+    uint64_t length = 0;
+    
+public:
+    BidArchive() = default;
+    BidArchive(const BidArchive&) = delete;
+    BidArchive& operator=(const BidArchive&) = delete;
+    
+    ~BidArchive() {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+    
+    bool open(const string& path) {
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            cerr << "Cannot open archive " << path << ": " << strerror(errno) << endl;
+            return false;
+        }
+        return true;
+    }
+    
+    // Appends `count` bids and sets `offset` to where they start. Appends
+    // must not run concurrently; reads of earlier appends may.
+    bool append(const Bid* bids, size_t count, uint64_t& offset) {
+        const char* bytes = (const char*)bids;
+        size_t size = count * sizeof(Bid);
+        uint64_t at = length;
+        while (size > 0) {
+            ssize_t n = ::pwrite(fd, bytes, size, (off_t)at);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                cerr << "Cannot write archive: " << strerror(errno) << endl;
+                return false;
+            }
+            bytes += n;
+            size -= (size_t)n;
+            at += (uint64_t)n;
+        }
+        offset = length;
+        length = at;
+        return true;
+    }
+    
+    // Reads `count` bids starting `first` bids past `offset`
+    bool read(uint64_t offset, size_t first, size_t count, vector<Bid>& out) const {
+        out.assign(count, Bid(NO_ID, 0.0, time_point<system_clock>()));
+        char* bytes = (char*)out.data();
+        size_t size = count * sizeof(Bid);
+        uint64_t at = offset + first * sizeof(Bid);
+        while (size > 0) {
+            ssize_t n = ::pread(fd, bytes, size, (off_t)at);
+            if (n <= 0) {
+                if (n < 0 && errno == EINTR) continue;
+                cerr << "Cannot read archive: " << (n < 0 ? strerror(errno) : "truncated") << endl;
+                out.clear();
+                return false;
+            }
+            bytes += n;
+            size -= (size_t)n;
+            at += (uint64_t)n;
+        }
+        return true;
+    }
+    
+    uint64_t size() const {
+        return length;
+    }
+};
+
+// Writes the operations applied to an AuctionSystem as a batch command stream
+// (see runBatch) with a `T` line before each command whose logical time
+// differs from the previous one. The stream replays with --batch at its
+// original pace, a multiple of it or flat out. Commands from several sessions
+// are interleaved by switching the stream's login with L and O lines.
+class CommandRecorder {
+private:
+    ofstream out;
+    time_point<steady_clock> origin;
+    int64_t lastMicros = 0;
+    UserId sessionUser = NO_ID; // whose session the stream is logged in as
+    
+public:
+    bool open(const string& path) {
+        out.open(path, ios::trunc);
+        if (!out) {
+            cerr << "Cannot open record file: " << path << endl;
+            return false;
+        }
+        origin = Clock::now();
+        out << "T 0 " << duration_cast<milliseconds>(Clock::wallNow().time_since_epoch()).count() << '\n';
+        return true;
+    }
+    
+    void record(const string& command) {
+        int64_t micros = duration_cast<microseconds>(Clock::now() - origin).count();
+        if (micros != lastMicros) {
+            out << "T " << micros / 1000000 << '.' << setw(6) << setfill('0') << micros % 1000000 << setfill(' ') << '\n';
+            lastMicros = micros;
+        }
+        out << command << '\n';
+    }
+    
+    // Records a command issued by `userId`, logging the stream in as them first
+    void record(UserId userId, const string& username, const string& command) {
+        if (userId != sessionUser) {
+            record(userId == NO_ID ? string("O") : "L " + username);
+            sessionUser = userId;
+        }
+        record(command);
+    }
+    
+    void flush() {
+        out.flush();
+    }
+};
+
+// Latency of each command of a batch run, by command letter (see runBatch)
+struct BatchStats {
+    LatencyHistogram latency[26];
+};
+
+// Thread safety: placeBid/submitBid, addBalance and the read-only queries may
+// be called from many threads at once, each with its own Session. Bids only
+// lock the auction and the bidding user; catalogLock serializes structural
+// changes (new users and auctions, settlement bookkeeping, the indexes).
+// The console wrappers (registerUser, loginUser, ...) act on consoleSession
+// and are meant for the single interactive or batch thread.
+class AuctionSystem {
+private:
+    StableVector<User> users; // indexed by UserId
+    StableVector<Auction> auctions; // indexed by ItemId
+    StableVector<AuctionHot> hotRecords; // indexed by ItemId; each Auction refers to its own
+    StableVector<Item> items; // indexed by ItemId
+    SymbolTable userIds;
+    SymbolTable itemIds;
+    unordered_map<string, UserId> usernameIndex; // username -> UserId, kept in step with users
+    Session consoleSession;
+    BidReporter bidReporter;
+    mutable shared_mutex catalogLock;
+    
+    // Expiry index: min-heap on end time over every auction that was open when
+    // pushed. Entries for auctions ended by hand are skipped when popped.
+    using ExpiryEntry = pair<time_point<steady_clock>, ItemId>;
+    priority_queue<ExpiryEntry, vector<ExpiryEntry>, greater<ExpiryEntry>> expiryQueue;
+    vector<ItemId> activeItems; // open auctions, in no particular order
+    vector<uint32_t> activeSlot; // ItemId -> position in activeItems, NO_ID once closed
+    // Earliest end time in expiryQueue, readable without catalogLock
+    atomic<steady_clock::rep> nextExpiry{numeric_limits<steady_clock::rep>::max()};
+    // Dutch auctions taken by a bid, waiting for settleExpiredAuctions. While
+    // any wait nextExpiry is in the past so the next call takes the slow path.
+    mutex closeQueueLock;
+    vector<ItemId> closeQueue;
+    
+    // Browse indexes over open auctions, by current price and by end time.
+    // Bids do not touch them: an auction whose price moved is queued once and
+    // the price index catches up at the next browse, so a hot item costs one
+    // reindex per query instead of one per bid. Lock order is catalogLock ->
+    // browseLock -> Auction::lock; the bid path only takes priceQueueLock.
+    mutex browseLock;
+    set<pair<double, ItemId>> priceIndex;
+    vector<double> indexedPrice; // ItemId -> its key in priceIndex
+    set<pair<time_point<steady_clock>, ItemId>> endIndex;
+    mutex priceQueueLock;
+    vector<ItemId> priceQueue;
+    
+    unique_ptr<ShardedBidEngine> shardEngine; // null unless enableSharding was called
+    
+    // Hot-path instrumentation. Call sites are the same either way; without
+    // AUCTION_METRICS the clock is an empty struct and the recorders are no-ops.
+#ifdef AUCTION_METRICS
+    mutable Metrics metrics;
+    mutable mutex rateLock; // guards the bid-rate sample below
+    mutable vector<uint32_t> rateBidCounts; // per item, at the previous sample
+    mutable time_point<steady_clock> rateSampleTime;
+    
+    static time_point<steady_clock> metricsClock() {
+        return steady_clock::now();
+    }
+    
+    static uint64_t nanosSince(time_point<steady_clock> started) {
+        return (uint64_t)duration_cast<nanoseconds>(steady_clock::now() - started).count();
+    }
+    
+    void recordBid(const BidResult& result, time_point<steady_clock> started) const {
+        metrics.recordBid(result.status, nanosSince(started));
+    }
+    
+    void recordOp(MetricOp op, time_point<steady_clock> started) const {
+        metrics.record(op, nanosSince(started));
+    }
+#else
+    struct NoClock {};
+    static NoClock metricsClock() { return NoClock(); }
+    void recordBid(const BidResult&, NoClock) const {}
+    void recordOp(MetricOp, NoClock) const {}
+#endif
+    atomic<double> proxyIncrement{1.0};
+    // Per-user bid admission; a rate of 0 admits everything
+    atomic<double> bidRate{0.0};
+    atomic<double> bidBurst{0.0};
+    
+    // Returns a RateLimited result if the user is over their bid rate,
+    // otherwise an Accepted one. Checked before a bid is queued or applied.
+    BidResult admitBid(const Session& session, double amount) {
+        double rate = bidRate.load(memory_order_relaxed);
+        if (rate <= 0.0) {
+            return BidResult(BidStatus::Accepted, amount);
+        }
+        User& user = users[session.userId];
+        lock_guard<mutex> guard(user.lock);
+        if (!user.takeBidToken(rate, bidBurst.load(memory_order_relaxed), Clock::now())) {
+            return BidResult(BidStatus::RateLimited, amount, rate);
+        }
+        return BidResult(BidStatus::Accepted, amount);
+    }
+    
+    // Event feed. Changed auctions are queued once and published together by
+    // publishEvents, so a hot item shows up once per publish however many
+    // bids it took. Nothing is queued while there are no subscribers.
+    EventRing eventRing;
+    atomic<uint32_t> eventSubscribers{0};
+    mutex eventQueueLock;
+    vector<ItemId> eventQueue;
+    mutex publishLock; // one publisher at a time
+    
+    // Caller holds auction.lock
+    void queueEvent(Auction& auction, ItemId itemId, UserId leader, size_t bidCount) {
+        if (auction.eventQueued || eventSubscribers.load(memory_order_relaxed) == 0) {
+            return;
+        }
+        auction.eventQueued = true;
+        auction.eventLeader = leader;
+        auction.eventBidCount = (uint32_t)bidCount;
+        lock_guard<mutex> guard(eventQueueLock);
+        eventQueue.push_back(itemId);
+    }
+    
+    // Inverted index over item names and descriptions: term -> items containing it.
+    // Items are indexed in creation order, so every posting list is sorted.
+    unordered_map<string, vector<ItemId>> searchIndex;
+    
+    // Splits text into lowercase alphanumeric terms
+    static void tokenize(const string& text, vector<string>& terms) {
+        string term;
+        for (char c : text) {
+            if (isalnum((unsigned char)c)) {
+                term.push_back((char)tolower((unsigned char)c));
+            } else if (!term.empty()) {
+                terms.push_back(term);
+                term.clear();
+            }
+        }
+        if (!term.empty()) {
+            terms.push_back(term);
+        }
+    }
+    
+    void indexItem(const Item& item) {
+        vector<string> terms;
+        tokenize(item.name, terms);
+        tokenize(item.description, terms);
+        for (const auto& term : terms) {
+            vector<ItemId>& postings = searchIndex[term];
+            if (postings.empty() || postings.back() != item.id) {
+                postings.push_back(item.id);
+            }
+        }
+    }
+    
+    vector<ItemId> findAuctionsUnmetered(const string& query, const SearchOptions& options) const {
+        vector<string> terms;
+        tokenize(query, terms);
+        vector<ItemId> matches;
+        if (terms.empty()) {
+            return matches;
+        }
+        
+        shared_lock<shared_mutex> guard(catalogLock);
+        
+        // Intersect starting from the shortest posting list
+        vector<const vector<ItemId>*> lists;
+        for (const auto& term : terms) {
+            auto it = searchIndex.find(term);
+            if (it == searchIndex.end()) {
+                return matches;
+            }
+            lists.push_back(&it->second);
+        }
+        sort(lists.begin(), lists.end(), [](const vector<ItemId>* a, const vector<ItemId>* b) {
+            return a->size() < b->size();
+        });
+        
+        auto now = Clock::now();
+        for (ItemId itemId : *lists[0]) {
+            bool inAll = true;
+            for (size_t i = 1; i < lists.size() && inAll; i++) {
+                inAll = binary_search(lists[i]->begin(), lists[i]->end(), itemId);
+            }
+            if (!inAll) {
+                continue;
+            }
+            if (options.activeOnly) {
+                const Auction& auction = auctions[itemId];
+                lock_guard<mutex> auctionGuard(auction.lock);
+                if (!auction.isActive(now)) {
+                    continue;
+                }
+            }
+            matches.push_back(itemId);
+            if (options.limit != 0 && matches.size() >= options.limit) {
+                break;
+            }
+        }
+        return matches;
+    }
+    
+    int nextDisplayId = 1000;
+    
+    // Durability (see enablePersistence); wal is null when running in memory only
+    unique_ptr<WriteAheadLog> wal;
+    string dataDir;
+    uint64_t walGeneration = 0;
+    unique_ptr<MappedSnapshot> snapshotMapping; // backs the bid logs of auctions restored from it
+    unique_ptr<BidArchive> bidArchive; // holds the logs of settled auctions; see enableArchive
+    size_t archivedCount = 0;
+    bool replica = false; // follows a leader's log; see startReplica
+    
+    string generateId() {
+        return "ID" + to_string(nextDisplayId++);
+    }
+    
+    // Keeps generateId from handing out a display ID that was restored from disk
+    void noteDisplayId(const string& displayId) {
+        if (displayId.size() > 2) {
+            nextDisplayId = max(nextDisplayId, atoi(displayId.c_str() + 2) + 1);
+        }
+    }
+    
+
+    
+    // Caller holds catalogLock exclusively
+    void updateNextExpiry() {
+        lock_guard<mutex> guard(closeQueueLock);
+        nextExpiry.store(!closeQueue.empty() ? numeric_limits<steady_clock::rep>::min()
+                         : expiryQueue.empty() ? numeric_limits<steady_clock::rep>::max()
+                                               : expiryQueue.top().first.time_since_epoch().count(),
+                         memory_order_release);
+    }
+    
+    // Has the next settleExpiredAuctions end an auction whose end time has
+    // not come
+    void queueClose(ItemId itemId) {
+        lock_guard<mutex> guard(closeQueueLock);
+        closeQueue.push_back(itemId);
+        nextExpiry.store(numeric_limits<steady_clock::rep>::min(), memory_order_release);
+    }
+    
+    // Evaluates query over every auction's hot record, in ItemId order.
+    // Caller holds catalogLock.
+    vector<ItemId> scanCatalog(const ScanQuery& query) const {
+        vector<ItemId> matches;
+        hotRecords.forEachRun([&](const AuctionHot* run, size_t first, size_t count) {
+            HotScan::select(run, count, (ItemId)first, query, matches);
+        });
+        return matches;
+    }
+    
+    size_t countCatalog(const ScanQuery& query) const {
+        size_t matched = 0;
+        hotRecords.forEachRun([&](const AuctionHot* run, size_t, size_t count) {
+            matched += HotScan::count(run, count, query);
+        });
+        return matched;
+    }
+    
+    // Caller holds catalogLock exclusively
+    void addActive(ItemId itemId) {
+        const Auction& auction = auctions[itemId];
+        activeSlot.push_back((uint32_t)activeItems.size());
+        activeItems.push_back(itemId);
+        expiryQueue.push({auction.getHot().endTime, itemId});
+        
+        lock_guard<mutex> guard(browseLock);
+        indexedPrice.resize(auctions.size());
+        indexedPrice[itemId] = auction.getCurrentPrice();
+        priceIndex.emplace(indexedPrice[itemId], itemId);
+        endIndex.emplace(auction.getHot().endTime, itemId);
+    }
+    
+    // Caller holds catalogLock exclusively
+    void removeActive(ItemId itemId) {
+        uint32_t slot = activeSlot[itemId];
+        if (slot == NO_ID) {
+            return;
+        }
+        ItemId last = activeItems.back();
+        activeItems[slot] = last;
+        activeSlot[last] = slot;
+        activeItems.pop_back();
+        activeSlot[itemId] = NO_ID;
+        
+        lock_guard<mutex> guard(browseLock);
+        priceIndex.erase({indexedPrice[itemId], itemId});
+        endIndex.erase({hotRecords[itemId].endTime, itemId});
+    }
+    
+    // Caller holds auction.lock
+    void queuePriceUpdate(Auction& auction, ItemId itemId) {
+        if (auction.priceQueued) {
+            return;
+        }
+        auction.priceQueued = true;
+        lock_guard<mutex> guard(priceQueueLock);
+        priceQueue.push_back(itemId);
+    }
+    
+    // Moves queued auctions to their current price. Caller holds catalogLock
+    // (shared is enough) and browseLock.
+    void refreshPriceIndex() {
+        vector<ItemId> due;
+        {
+            lock_guard<mutex> guard(priceQueueLock);
+            due.swap(priceQueue);
+        }
+        for (ItemId itemId : due) {
+            Auction& auction = auctions[itemId];
+            double price;
+            {
+                lock_guard<mutex> guard(auction.lock);
+                auction.priceQueued = false;
+                price = auction.getCurrentPrice();
+            }
+            if (activeSlot[itemId] == NO_ID || price == indexedPrice[itemId]) {
+                continue;
+            }
+            priceIndex.erase({indexedPrice[itemId], itemId});
+            indexedPrice[itemId] = price;
+            priceIndex.emplace(price, itemId);
+        }
+    }
+    
+    // Runs fn(begin, end) over [0, count), split across threads when there
+    // are at least two chunks of minChunk
+    template <typename Fn>
+    static void parallelChunks(size_t count, size_t minChunk, Fn fn) {
+        size_t threads = min<size_t>(max(1u, thread::hardware_concurrency()), count / minChunk);
+        if (threads <= 1) {
+            fn((size_t)0, count);
+            return;
+        }
+        size_t step = (count + threads - 1) / threads;
+        vector<thread> workers;
+        for (size_t begin = step; begin < count; begin += step) {
+            workers.emplace_back(fn, begin, min(count, begin + step));
+        }
+        fn((size_t)0, step);
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+    
+    // One balance or ownership change produced by closing an auction
+    struct LedgerEntry {
+        enum Kind : uint8_t { Won, Sold, Released };
+        UserId user;
+        Kind kind;
+        uint32_t settlement; // index into the batch
+        double hold;
+    };
+    
+    // What the winner of `auction` pays under its format's rules; caller holds
+    // the auction's lock and has checked that it has bids
+    static double salePrice(const Auction& auction) {
+        return withRules(auction.getRules().format, [&](auto rules) {
+            return decltype(rules)::salePrice(auction);
+        });
+    }
+    
+    // Closes the given open auctions and transfers money and ownership for
+    // those that sold. Winners are found in parallel, one auction at a time;
+    // the resulting ledger entries are then grouped by user so each User is
+    // locked once however many of the batch it won or sold. Caller holds
+    // catalogLock exclusively and has checked that every item is open.
+    vector<Settlement> settleBatch(const vector<ItemId>& items) {
+        static constexpr size_t PARALLEL_CHUNK = 2048;
+        auto started = metricsClock();
+        vector<Settlement> settled(items.size());
+        vector<Hold> holds(items.size());
+        
+        parallelChunks(items.size(), PARALLEL_CHUNK, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                Auction& auction = auctions[items[i]];
+                Settlement& settlement = settled[i];
+                settlement = Settlement{items[i], SettlementStatus::NoBids, NO_ID, 0.0};
+                lock_guard<mutex> guard(auction.lock);
+                holds[i] = auction.getHold();
+                double price = auction.hasBids() ? salePrice(auction) : 0.0;
+                auction.endAuction(price);
+                queueEvent(auction, items[i], auction.hasBids() ? auction.getHighestBid().bidder : NO_ID, auction.getBidCount());
+                if (auction.hasBids()) {
+                    settlement.winner = auction.getHighestBid().bidder;
+                    settlement.price = price;
+                    settlement.status = auction.hasReserveBeenMet() ? SettlementStatus::Sold : SettlementStatus::ReserveNotMet;
+                }
+            }
+        });
+        
+        vector<LedgerEntry> entries;
+        entries.reserve(items.size() * 2);
+        for (uint32_t i = 0; i < settled.size(); i++) {
+            removeActive(settled[i].item);
+            if (settled[i].status == SettlementStatus::Sold) {
+                entries.push_back({settled[i].winner, LedgerEntry::Won, i, holds[i].amount});
+                entries.push_back({hotRecords[settled[i].item].sellerId, LedgerEntry::Sold, i, 0.0});
+            } else if (holds[i].user != NO_ID) {
+                entries.push_back({holds[i].user, LedgerEntry::Released, i, holds[i].amount});
+            }
+        }
+        // Stable, so each user's changes apply in item order as a serial close would
+        stable_sort(entries.begin(), entries.end(), [](const LedgerEntry& a, const LedgerEntry& b) {
+            return a.user < b.user;
+        });
+        vector<size_t> groups;
+        for (size_t i = 0; i < entries.size(); i++) {
+            if (i == 0 || entries[i].user != entries[i - 1].user) {
+                groups.push_back(i);
+            }
+        }
+        groups.push_back(entries.size());
+        
+        // The winner's hold already covers the price; charged records whether
+        // the balance did, so replay does not depend on the order of balance
+        // changes on other threads
+        vector<uint8_t> charged(settled.size(), 0);
+        parallelChunks(groups.size() - 1, PARALLEL_CHUNK, [&](size_t begin, size_t end) {
+            for (size_t g = begin; g < end; g++) {
+                User& user = users[entries[groups[g]].user];
+                lock_guard<mutex> guard(user.lock);
+                for (size_t i = groups[g]; i < groups[g + 1]; i++) {
+                    const LedgerEntry& entry = entries[i];
+                    const Settlement& settlement = settled[entry.settlement];
+                    switch (entry.kind) {
+                        case LedgerEntry::Won:
+                            user.adjustReserved(-entry.hold);
+                            charged[entry.settlement] = user.balance >= settlement.price;
+                            user.deductBalance(settlement.price);
+                            user.addOwnedItem(settlement.item);
+                            break;
+                        case LedgerEntry::Sold:
+                            user.addBalance(settlement.price);
+                            user.addSoldItem(settlement.item);
+                            break;
+                        case LedgerEntry::Released:
+                            user.adjustReserved(-entry.hold);
+                            break;
+                    }
+                }
+            }
+        });
+        
+        if (wal) {
+            for (size_t i = 0; i < settled.size(); i++) {
+                BinaryWriter record;
+                record.put(settled[i].item);
+                record.put((uint8_t)settled[i].status);
+                record.put(settled[i].winner);
+                record.put(settled[i].price);
+                record.put(charged[i]);
+                wal->append(WalRecordType::Settle, record);
+            }
+        }
+        if (bidArchive) {
+            archiveAuctions(items);
+        }
+#ifdef AUCTION_METRICS
+        size_t byStatus[Metrics::SETTLEMENT_COUNT] = {};
+        for (const auto& settlement : settled) {
+            byStatus[(size_t)settlement.status]++;
+        }
+        for (size_t status = 0; status < Metrics::SETTLEMENT_COUNT; status++) {
+            metrics.recordSettlement((SettlementStatus)status, byStatus[status]);
+        }
+#endif
+        recordOp(MetricOp::EndAuction, started);
+        return settled;
+    }
+    
+    // Moves the logs of the given ended auctions to the archive, a chunk per
+    // write. Mapped logs are already out of memory and stay where they are.
+    // Caller holds catalogLock exclusively, so appends never overlap.
+    void archiveAuctions(const vector<ItemId>& items) {
+        static constexpr size_t CHUNK_BIDS = 1 << 16;
+        vector<Bid> staged;
+        vector<pair<ItemId, uint64_t>> pending; // item and offset within staged
+        auto flush = [&]() {
+            uint64_t base;
+            if (!pending.empty() && bidArchive->append(staged.data(), staged.size(), base)) {
+                for (const auto& entry : pending) {
+                    Auction& auction = auctions[entry.first];
+                    lock_guard<mutex> guard(auction.lock);
+                    auction.archive(base + entry.second * sizeof(Bid));
+                }
+                archivedCount += pending.size();
+            }
+            staged.clear();
+            pending.clear();
+        };
+        for (ItemId itemId : items) {
+            {
+                const Auction& auction = auctions[itemId];
+                lock_guard<mutex> guard(auction.lock);
+                // The flag, not the clock: an expired auction is archived once it is settled
+                if (auction.getHot().isActive.load(memory_order_relaxed) || !auction.hasBids() ||
+                    auction.isMapped() || auction.isArchived()) {
+                    continue;
+                }
+                BidSpan log = auction.getBidHistory();
+                pending.push_back({itemId, staged.size()});
+                staged.insert(staged.end(), log.begin(), log.end());
+            }
+            if (staged.size() >= CHUNK_BIDS) {
+                flush();
+            }
+        }
+        flush();
+    }
+    
+    // One newest-first page of an auction's bids (see BidSpan::newest),
+    // read back into `buffer` if the auction is archived. Caller holds
+    // auction.lock; the page is valid until the lock is released.
+    BidSpan historyPage(const Auction& auction, size_t offset, size_t limit, vector<Bid>& buffer) const {
+        if (!auction.isArchived()) {
+            return auction.getBidHistory(offset, limit);
+        }
+        size_t count = auction.getBidCount();
+        offset = min(offset, count);
+        size_t n = limit != 0 ? min(count - offset, limit) : count - offset;
+        bidArchive->read(auction.getArchiveOffset(), count - offset - n, n, buffer);
+        return BidSpan(buffer.data(), buffer.size());
+    }
+    
+    // Closes one open auction. Caller holds catalogLock exclusively.
+    Settlement settleAuction(ItemId itemId) {
+        return settleBatch(vector<ItemId>{itemId})[0];
+    }
+    
+    void adjustReserved(UserId userId, double delta) {
+        if (userId == NO_ID || delta == 0.0) {
+            return;
+        }
+        User& user = users[userId];
+        lock_guard<mutex> guard(user.lock);
+        user.adjustReserved(delta);
+    }
+    
+    // Moves ledger holds after an auction's leader or commitment changed.
+    // `tentative` is what was already reserved for `bidder` up front.
+    void transferHold(const Hold& before, const Hold& after, UserId bidder = NO_ID, double tentative = 0.0) {
+        adjustReserved(bidder, after.of(bidder) - before.of(bidder) - tentative);
+        if (before.user != bidder) {
+            adjustReserved(before.user, after.of(before.user) - before.amount);
+        }
+        if (after.user != bidder && after.user != before.user) {
+            adjustReserved(after.user, after.amount);
+        }
+    }
+    
+    // Applies one bid to an auction whose lock the caller holds. Lock order is
+    // always catalogLock -> Auction::lock -> User::lock.
+    //
+    // Balances are not owned by any shard: a user can bid on several shards at
+    // once, so the check and the bid-history append go through the user's own
+    // lock, and money only moves in settleAuction. Shards never touch each
+    // other's auctions.
+    //
+    // With `proxy` set, amount is the most the user will pay and the auction
+    // bids for them (see Auction::placeProxyBid). The visible bid appended may
+    // then belong to another user, so the WAL records who bid and who asked.
+    BidResult applyBidLocked(Auction& auction, const Session& session, ItemId itemId, double amount, bool proxy = false) {
+        return withRules(auction.getRules().format, [&](auto rules) {
+            return applyBidLocked<decltype(rules)>(auction, session, itemId, amount, proxy);
+        });
+    }
+    
+    // The same for a caller that already knows the auction's rules
+    template <typename Rules>
+    BidResult applyBidLocked(Auction& auction, const Session& session, ItemId itemId, double amount, bool proxy = false) {
+        auto started = metricsClock();
+        BidResult result = applyBidUnmetered<Rules>(auction, session, itemId, amount, proxy);
+        recordBid(result, started);
+        return result;
+    }
+    
+    template <typename Rules>
+    BidResult applyBidUnmetered(Auction& auction, const Session& session, ItemId itemId, double amount, bool proxy) {
+        if (!session.loggedIn()) {
+            return BidResult(BidStatus::NotLoggedIn, amount);
+        }
+        
+        // The bid is reserved before it is placed, so two bids by the same
+        // user on different shards cannot both spend the same funds. What the
+        // user already holds on this auction counts towards it.
+        User& user = users[session.userId];
+        Hold before = auction.getHold();
+        double tentative = max(0.0, amount - before.of(session.userId));
+        {
+            lock_guard<mutex> guard(user.lock);
+            if (!user.canBid(tentative)) {
+                return BidResult(BidStatus::InsufficientBalance, amount, user.available());
+            }
+            user.adjustReserved(tentative);
+        }
+        
+        size_t bidCount = auction.getBidCount();
+        UserId leader = bidCount > 0 ? auction.getHighestBid().bidder : NO_ID;
+        ProxyBid standing = auction.getProxy();
+        BidResult result = proxy ? auction.placeProxyBid<Rules>(session.userId, amount, proxyIncrement)
+                                 : auction.placeBid<Rules>(session.userId, amount);
+        transferHold(before, auction.getHold(), session.userId, tentative);
+        bool appended = auction.getBidCount() != bidCount;
+        const ProxyBid& now = auction.getProxy();
+        bool proxyChanged = now.bidder != standing.bidder || now.maxAmount != standing.maxAmount ||
+                            now.increment != standing.increment;
+        
+        if (wal && appended) {
+            const Bid& bid = auction.getLastPlaced();
+            BinaryWriter record;
+            record.put(itemId);
+            record.put(bid.bidder);
+            record.put(bid.amount);
+            record.put(toWallNanos(bid.timestamp));
+            record.put(session.userId);
+            wal->append(WalRecordType::Bid, record);
+        }
+        if (wal && proxyChanged) {
+            BinaryWriter record;
+            record.put(itemId);
+            record.put(now.bidder);
+            record.put(now.maxAmount);
+            record.put(now.increment);
+            wal->append(WalRecordType::Proxy, record);
+        }
+        // A sealed auction's feed and price stay still until it ends
+        if (appended && !Rules::SEALED) {
+            queueEvent(auction, itemId, leader, bidCount);
+            queuePriceUpdate(auction, itemId);
+        }
+        if (appended && Rules::CLOSES_ON_BID) {
+            queueClose(itemId);
+        }
+        if (appended) {
+            lock_guard<mutex> guard(user.lock);
+            user.addBidToHistory(itemId);
+        }
+        return result;
+    }
+    
+    // Decides a run of plain bids on one auction highest first. Once the
+    // highest viable bid is in, every other bid of the run is dominated: taken
+    // in arrival order it would have been outbid within the same batch. Those
+    // are answered from checkBid without touching the auction, so a burst
+    // costs one bid's work. Bids turned away for reasons of their own (funds,
+    // own item, not logged in) leave the next highest as the candidate.
+    // Ties go to the earlier bid. Only for formats where a higher bid
+    // supersedes a lower one in the open (Rules::PROXIES).
+    template <typename Rules, typename It>
+    void applyHighestFirst(Auction& auction, ItemId itemId, const vector<BidCommand>& batch, It begin, It end, vector<BidResult>& results) {
+        stable_sort(begin, end, [&](uint32_t a, uint32_t b) {
+            return batch[a].amount > batch[b].amount;
+        });
+        It next = begin;
+        while (next != end) {
+            const BidCommand& command = batch[*next];
+            BidResult& result = results[*next++] = applyBidLocked<Rules>(auction, command.session, itemId, command.amount);
+            bool ownReason = result.status == BidStatus::NotLoggedIn || result.status == BidStatus::OwnItem ||
+                             result.status == BidStatus::InsufficientBalance;
+            if (!ownReason) {
+                break;
+            }
+        }
+        for (; next != end; ++next) {
+            auto started = metricsClock();
+            const BidCommand& command = batch[*next];
+            BidResult result = command.session.loggedIn() ? auction.checkBid<Rules>(command.session.userId, command.amount)
+                                                          : BidResult(BidStatus::NotLoggedIn, command.amount);
+            if (result.accepted()) {
+                result = applyBidLocked<Rules>(auction, command.session, itemId, command.amount); // not dominated after all
+            } else {
+                recordBid(result, started);
+            }
+            results[*next] = result;
+        }
+    }
+    
+    // Applies one auction's run of a shard batch under its lock
+    template <typename Rules, typename It>
+    void applyRun(Auction& auction, ItemId itemId, const vector<BidCommand>& batch, It begin, It end, vector<BidResult>& results) {
+        // Proxy bids keep arrival order: their outcome depends on what came before
+        bool plain = none_of(begin, end, [&](uint32_t i) { return batch[i].proxy; });
+        if (Rules::PROXIES && plain && end - begin > 1) {
+            applyHighestFirst<Rules>(auction, itemId, batch, begin, end, results);
+            return;
+        }
+        for (It next = begin; next != end; ++next) {
+            const BidCommand& command = batch[*next];
+            results[*next] = applyBidLocked<Rules>(auction, command.session, itemId, command.amount, command.proxy);
+        }
+    }
+    
+    // Shard worker entry point. Commands are grouped by auction (keeping
+    // arrival order within each auction) so a burst on a hot item takes that
+    // auction's lock once for the whole run. The lock only keeps readers out;
+    // no other writer ever touches the shard's auctions.
+    void applyShardBatch(size_t, const vector<BidCommand>& batch, vector<BidResult>& results) {
+        results.assign(batch.size(), BidResult(BidStatus::AuctionNotFound, 0.0));
+        
+        vector<uint32_t> order(batch.size());
+        for (uint32_t i = 0; i < order.size(); i++) {
+            order[i] = i;
+        }
+        stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+            return batch[a].itemId < batch[b].itemId;
+        });
+        
+        size_t run = 0;
+        while (run < order.size()) {
+            ItemId itemId = batch[order[run]].itemId;
+            size_t end = run;
+            while (end < order.size() && batch[order[end]].itemId == itemId) {
+                end++;
+            }
+            
+            if (itemId < auctions.size()) {
+                Auction& auction = auctions[itemId];
+                lock_guard<mutex> guard(auction.lock);
+                withRules(auction.getRules().format, [&](auto rules) {
+                    applyRun<decltype(rules)>(auction, itemId, batch, order.begin() + run, order.begin() + end, results);
+                });
+            } else {
+                for (size_t i = run; i < end; i++) {
+                    results[order[i]] = BidResult(BidStatus::AuctionNotFound, batch[order[i]].amount);
+                    recordBid(results[order[i]], metricsClock());
+                }
+            }
+            run = end;
+        }
+    }
+    
+    string snapshotPath() const {
+        return dataDir + "/snapshot.bin";
+    }
+    
+    string walPath() const {
+        return dataDir + "/wal.log";
+    }
+    
+    void syncDirectory() const {
+        int dirFd = ::open(dataDir.c_str(), O_RDONLY);
+        if (dirFd >= 0) {
+            ::fsync(dirFd);
+            ::close(dirFd);
+        }
+    }
+    
+    // ---- Recovery: these apply recorded facts without re-validating them ----
+    
+    UserId restoreUser(const string& displayId, const string& username, const string& email, double balance) {
+        noteDisplayId(displayId);
+        UserId userId = userIds.intern(displayId);
+        users.emplace_back(userId, username, email, balance);
+        usernameIndex.emplace(username, userId);
+        return userId;
+    }
+    
+    ItemId restoreAuction(const string& displayId, UserId sellerId, const string& name, const string& description,
+                          double startingPrice, double reservePrice, int64_t startWall, int64_t endWall, bool active,
+                          const AuctionRules& rules, const Bid* bids = nullptr, size_t bidCount = 0) {
+        noteDisplayId(displayId);
+        ItemId itemId = itemIds.intern(displayId);
+        Item& item = items.emplace_back(itemId, name, description);
+        item.startTime = fromWallMillis(startWall);
+        AuctionHot& hot = hotRecords.emplace_back(startingPrice, reservePrice, sellerId, fromWallMillis(endWall));
+        hot.isActive = active;
+        Auction& auction = auctions.emplace_back(hot, bids, bidCount);
+        auction.setRules(rules, item.startTime);
+        
+        if (active) {
+            addActive(itemId);
+        } else {
+            activeSlot.push_back(NO_ID);
+        }
+        // The hot record shows the highest bid; an ended auction shows what was paid
+        if (!active && auction.hasBids()) {
+            auction.endAuction(salePrice(auction));
+        }
+        // Taken by a bid just before the snapshot; it closes on the next settle
+        if (active && auction.hasBids() && rules.format == AuctionFormat::Dutch) {
+            queueClose(itemId);
+        }
+        return itemId;
+    }
+    
+    void restoreSettlement(ItemId itemId, SettlementStatus status, UserId winnerId, double price, bool charged) {
+        Auction& auction = auctions[itemId];
+        Hold hold = auction.getHold();
+        auction.endAuction(price);
+        queueEvent(auction, itemId, auction.hasBids() ? auction.getHighestBid().bidder : NO_ID, auction.getBidCount());
+        removeActive(itemId);
+        transferHold(hold, Hold());
+        if (status != SettlementStatus::Sold) {
+            return;
+        }
+        User& winner = users[winnerId];
+        if (charged) {
+            winner.balance -= price;
+        }
+        winner.addOwnedItem(itemId);
+        User& seller = users[hotRecords[itemId].sellerId];
+        seller.addBalance(price);
+        seller.addSoldItem(itemId);
+    }
+    
+    bool applyLogRecord(WalRecordType type, BinaryReader& record) {
+        switch (type) {
+            case WalRecordType::RegisterUser: {
+                string displayId = record.getString();
+                string username = record.getString();
+                string email = record.getString();
+                double balance = record.get<double>();
+                if (!record.ok()) return false;
+                restoreUser(displayId, username, email, balance);
+                return true;
+            }
+            
+            case WalRecordType::CreateAuction: {
+                string displayId = record.getString();
+                UserId sellerId = record.get<UserId>();
+                string name = record.getString();
+                string description = record.getString();
+                double startingPrice = record.get<double>();
+                double reservePrice = record.get<double>();
+                int64_t startWall = record.get<int64_t>();
+                int64_t endWall = record.get<int64_t>();
+                // Absent from records written before auctions had formats
+                AuctionRules rules;
+                if (!record.atEnd()) {
+                    rules.format = (AuctionFormat)record.get<uint8_t>();
+                    rules.increment = record.get<double>();
+                }
+                if (!record.ok() || sellerId >= users.size() || rules.format > AuctionFormat::Dutch) return false;
+                ItemId itemId = restoreAuction(displayId, sellerId, name, description, startingPrice, reservePrice, startWall, endWall, true, rules);
+                indexItem(items[itemId]);
+                users[sellerId].addCreatedAuction(itemId);
+                return true;
+            }
+            
+            case WalRecordType::Bid: {
+                ItemId itemId = record.get<ItemId>();
+                UserId userId = record.get<UserId>();
+                double amount = record.get<double>();
+                int64_t wallTime = record.get<int64_t>();
+                // Who placed the bid, when a proxy answered it on someone else's behalf
+                UserId requester = record.atEnd() ? userId : record.get<UserId>();
+                if (!record.ok() || itemId >= auctions.size() || userId >= users.size() || requester >= users.size()) return false;
+                Auction& auction = auctions[itemId];
+                Hold before = auction.getHold();
+                UserId leader = auction.hasBids() ? auction.getHighestBid().bidder : NO_ID;
+                size_t bidCount = auction.getBidCount();
+                auction.restoreBid(userId, amount, fromWallNanos(wallTime));
+                // Feeds a follower's subscribers; nobody is subscribed during recovery
+                if (!auction.bidsSealed()) {
+                    queueEvent(auction, itemId, leader, bidCount);
+                }
+                queuePriceUpdate(auctions[itemId], itemId);
+                transferHold(before, auctions[itemId].getHold());
+                users[requester].addBidToHistory(itemId);
+                // Settled by a later record unless the log ends first
+                if (auctions[itemId].getRules().format == AuctionFormat::Dutch) {
+                    queueClose(itemId);
+                }
+                return true;
+            }
+            
+            case WalRecordType::Proxy: {
+                ItemId itemId = record.get<ItemId>();
+                ProxyBid proxy;
+                proxy.bidder = record.get<UserId>();
+                proxy.maxAmount = record.get<double>();
+                proxy.increment = record.get<double>();
+                if (!record.ok() || itemId >= auctions.size() || (proxy.active() && proxy.bidder >= users.size())) return false;
+                Hold before = auctions[itemId].getHold();
+                auctions[itemId].restoreProxy(proxy);
+                transferHold(before, auctions[itemId].getHold());
+                return true;
+            }
+            
+            case WalRecordType::Settle: {
+                ItemId itemId = record.get<ItemId>();
+                auto status = (SettlementStatus)record.get<uint8_t>();
+                UserId winner = record.get<UserId>();
+                double price = record.get<double>();
+                bool charged = record.get<uint8_t>() != 0;
+                if (!record.ok() || itemId >= auctions.size()) return false;
+                if (status == SettlementStatus::Sold && winner >= users.size()) return false;
+                restoreSettlement(itemId, status, winner, price, charged);
+                return true;
+            }
+            
+            case WalRecordType::AddBalance: {
+                UserId userId = record.get<UserId>();
+                double amount = record.get<double>();
+                if (!record.ok() || userId >= users.size()) return false;
+                users[userId].addBalance(amount);
+                return true;
+            }
+        }
+        return false;
+    }
+    
+    static uint64_t alignUp(uint64_t offset) {
+        return (offset + 7) & ~(uint64_t)7;
+    }
+    
+    static SnapshotString putString(string& pool, const string& value) {
+        SnapshotString entry{pool.size(), (uint32_t)value.size(), 0};
+        pool += value;
+        return entry;
+    }
+    
+    static bool writeFully(int fd, const void* data, size_t size) {
+        const char* bytes = (const char*)data;
+        while (size > 0) {
+            ssize_t n = ::write(fd, bytes, size);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            bytes += n;
+            size -= (size_t)n;
+        }
+        return true;
+    }
+    
+    // Writes the flat layout described above SnapshotHeader. Caller holds
+    // catalogLock exclusively.
+    bool writeSnapshot(const string& path, uint64_t generation) const {
+        vector<SnapshotUser> userTable(users.size());
+        vector<SnapshotAuction> auctionTable(auctions.size());
+        vector<SnapshotTerm> termTable;
+        vector<uint32_t> idPool;
+        vector<ItemId> postingPool;
+        vector<Bid> bidPool;
+        string stringPool;
+        
+        for (size_t i = 0; i < users.size(); i++) {
+            const User& user = users[i];
+            lock_guard<mutex> guard(user.lock);
+            SnapshotUser& entry = userTable[i];
+            entry.displayId = putString(stringPool, userIds.name(user.id));
+            entry.username = putString(stringPool, user.username);
+            entry.email = putString(stringPool, user.email);
+            entry.balance = user.balance;
+            entry.reserved = user.reserved;
+            entry.listIndex = idPool.size();
+            entry.bidCount = (uint32_t)user.bidHistory.size();
+            entry.ownedCount = (uint32_t)user.ownedItems.size();
+            entry.soldCount = (uint32_t)user.soldItems.size();
+            entry.createdCount = (uint32_t)user.createdAuctions.size();
+            idPool.insert(idPool.end(), user.bidHistory.begin(), user.bidHistory.end());
+            idPool.insert(idPool.end(), user.ownedItems.begin(), user.ownedItems.end());
+            idPool.insert(idPool.end(), user.soldItems.begin(), user.soldItems.end());
+            idPool.insert(idPool.end(), user.createdAuctions.begin(), user.createdAuctions.end());
+        }
+        
+        for (size_t i = 0; i < auctions.size(); i++) {
+            const Auction& auction = auctions[i];
+            lock_guard<mutex> guard(auction.lock);
+            const Item& item = items[i];
+            const AuctionHot& hot = auction.getHot();
+            SnapshotAuction& entry = auctionTable[i];
+            entry.displayId = putString(stringPool, itemIds.name(item.id));
+            entry.name = putString(stringPool, item.name);
+            entry.description = putString(stringPool, item.description);
+            entry.startingPrice = hot.startingPrice;
+            entry.reservePrice = hot.reservePrice;
+            entry.startWall = toWallMillis(item.startTime);
+            entry.endWall = toWallMillis(hot.endTime);
+            vector<Bid> archived;
+            BidSpan bids = historyPage(auction, 0, 0, archived);
+            entry.bidIndex = bidPool.size();
+            entry.bidCount = (uint32_t)bids.size();
+            entry.sellerId = hot.sellerId;
+            entry.active = hot.isActive ? 1 : 0;
+            entry.proxyBidder = auction.getProxy().bidder;
+            entry.proxyMax = auction.getProxy().maxAmount;
+            entry.proxyIncrement = auction.getProxy().increment;
+            entry.ruleIncrement = auction.getRules().increment;
+            entry.format = (uint32_t)auction.getRules().format;
+            entry.reserved = 0;
+            bidPool.insert(bidPool.end(), bids.begin(), bids.end());
+        }
+        
+        // Terms are sorted so the file is deterministic for a given state
+        vector<const pair<const string, vector<ItemId>>*> terms;
+        terms.reserve(searchIndex.size());
+        for (const auto& entry : searchIndex) {
+            terms.push_back(&entry);
+        }
+        sort(terms.begin(), terms.end(), [](const auto* a, const auto* b) {
+            return a->first < b->first;
+        });
+        for (const auto* entry : terms) {
+            termTable.push_back({putString(stringPool, entry->first), postingPool.size(), (uint32_t)entry->second.size(), 0});
+            postingPool.insert(postingPool.end(), entry->second.begin(), entry->second.end());
+        }
+        
+        SnapshotHeader header{};
+        header.magic = 0x504E5341; // "ASNP"
+        header.version = 5;
+        header.generation = generation;
+        header.nextDisplayId = nextDisplayId;
+        header.userCount = (uint32_t)userTable.size();
+        header.auctionCount = (uint32_t)auctionTable.size();
+        header.termCount = (uint32_t)termTable.size();
+        header.usersOffset = sizeof(SnapshotHeader);
+        header.auctionsOffset = header.usersOffset + userTable.size() * sizeof(SnapshotUser);
+        header.termsOffset = header.auctionsOffset + auctionTable.size() * sizeof(SnapshotAuction);
+        header.idsOffset = header.termsOffset + termTable.size() * sizeof(SnapshotTerm);
+        header.postingsOffset = alignUp(header.idsOffset + idPool.size() * sizeof(uint32_t));
+        header.stringsOffset = alignUp(header.postingsOffset + postingPool.size() * sizeof(ItemId));
+        header.bidsOffset = alignUp(header.stringsOffset + stringPool.size());
+        header.fileSize = header.bidsOffset + bidPool.size() * sizeof(Bid);
+        
+        // Metadata is assembled in one buffer so its CRC can be taken before writing
+        string metadata(header.bidsOffset - header.usersOffset, '\0');
+        auto place = [&](uint64_t offset, const void* data, size_t size) {
+            if (size > 0) {
+                memcpy(&metadata[offset - header.usersOffset], data, size);
+            }
+        };
+        place(header.usersOffset, userTable.data(), userTable.size() * sizeof(SnapshotUser));
+        place(header.auctionsOffset, auctionTable.data(), auctionTable.size() * sizeof(SnapshotAuction));
+        place(header.termsOffset, termTable.data(), termTable.size() * sizeof(SnapshotTerm));
+        place(header.idsOffset, idPool.data(), idPool.size() * sizeof(uint32_t));
+        place(header.postingsOffset, postingPool.data(), postingPool.size() * sizeof(ItemId));
+        place(header.stringsOffset, stringPool.data(), stringPool.size());
+        header.metadataCrc = crc32(metadata.data(), metadata.size());
+        
+        int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            cerr << "Cannot write snapshot " << path << ": " << strerror(errno) << endl;
+            return false;
+        }
+        if (!writeFully(fd, &header, sizeof header) || !writeFully(fd, metadata.data(), metadata.size()) ||
+            !writeFully(fd, bidPool.data(), bidPool.size() * sizeof(Bid))) {
+            cerr << "Cannot write snapshot " << path << ": " << strerror(errno) << endl;
+            ::close(fd);
+            return false;
+        }
+        bool synced = ::fsync(fd) == 0;
+        ::close(fd);
+        return synced;
+    }
+    
+    // Replaces the (empty) in-memory state with the snapshot. Users, items and
+    // the search index are copied out of the mapping; bid logs stay in it and
+    // are only copied when an auction takes a new bid. Returns false if the
+    // file is missing or damaged.
+    bool loadSnapshot(const string& path) {
+        auto mapping = make_unique<MappedSnapshot>();
+        if (!mapping->open(path)) {
+            return false;
+        }
+        const SnapshotHeader* header = mapping->at<SnapshotHeader>(0, 1);
+        if (header->magic != 0x504E5341 || header->version != 5 || header->fileSize != mapping->size() ||
+            header->usersOffset + (uint64_t)header->userCount * sizeof(SnapshotUser) > header->auctionsOffset ||
+            header->auctionsOffset + (uint64_t)header->auctionCount * sizeof(SnapshotAuction) > header->termsOffset ||
+            header->termsOffset + (uint64_t)header->termCount * sizeof(SnapshotTerm) > header->idsOffset ||
+            header->idsOffset > header->postingsOffset || header->postingsOffset > header->stringsOffset ||
+            header->stringsOffset > header->bidsOffset || header->bidsOffset > header->fileSize) {
+            return false;
+        }
+        const SnapshotUser* userTable = mapping->at<SnapshotUser>(header->usersOffset, header->userCount);
+        const SnapshotAuction* auctionTable = mapping->at<SnapshotAuction>(header->auctionsOffset, header->auctionCount);
+        const SnapshotTerm* termTable = mapping->at<SnapshotTerm>(header->termsOffset, header->termCount);
+        const uint32_t* idPool = mapping->at<uint32_t>(header->idsOffset, 0);
+        const ItemId* postingPool = mapping->at<ItemId>(header->postingsOffset, 0);
+        const Bid* bidPool = mapping->at<Bid>(header->bidsOffset, 0);
+        if (!userTable || !auctionTable || !termTable || !idPool || !postingPool || !bidPool ||
+            crc32(mapping->data() + header->usersOffset, header->bidsOffset - header->usersOffset) != header->metadataCrc) {
+            return false;
+        }
+        uint64_t idCount = (header->postingsOffset - header->idsOffset) / sizeof(uint32_t);
+        uint64_t postingCount = (header->stringsOffset - header->postingsOffset) / sizeof(ItemId);
+        uint64_t stringsSize = header->bidsOffset - header->stringsOffset;
+        uint64_t bidCount = (mapping->size() - header->bidsOffset) / sizeof(Bid);
+        const char* strings = mapping->data() + header->stringsOffset;
+        
+        bool valid = true;
+        auto getString = [&](const SnapshotString& entry) {
+            if (entry.offset > stringsSize || entry.size > stringsSize - entry.offset) {
+                valid = false;
+                return string();
+            }
+            return string(strings + entry.offset, entry.size);
+        };
+        
+        walGeneration = header->generation;
+        nextDisplayId = header->nextDisplayId;
+        
+        userIds.reserve(header->userCount);
+        usernameIndex.reserve(header->userCount);
+        for (uint32_t i = 0; i < header->userCount && valid; i++) {
+            const SnapshotUser& entry = userTable[i];
+            uint64_t listSize = (uint64_t)entry.bidCount + entry.ownedCount + entry.soldCount + entry.createdCount;
+            string displayId = getString(entry.displayId);
+            string username = getString(entry.username);
+            string email = getString(entry.email);
+            if (!valid || entry.listIndex > idCount || listSize > idCount - entry.listIndex) {
+                return false;
+            }
+            User& user = users[restoreUser(displayId, username, email, entry.balance)];
+            user.reserved = entry.reserved;
+            const uint32_t* list = idPool + entry.listIndex;
+            user.bidHistory.assign(list, list + entry.bidCount);
+            list += entry.bidCount;
+            user.ownedItems.assign(list, list + entry.ownedCount);
+            list += entry.ownedCount;
+            user.soldItems.assign(list, list + entry.soldCount);
+            list += entry.soldCount;
+            user.createdAuctions.assign(list, list + entry.createdCount);
+        }
+        
+        itemIds.reserve(header->auctionCount);
+        for (uint32_t i = 0; i < header->auctionCount && valid; i++) {
+            const SnapshotAuction& entry = auctionTable[i];
+            string displayId = getString(entry.displayId);
+            string name = getString(entry.name);
+            string description = getString(entry.description);
+            if (!valid || entry.sellerId >= users.size() || entry.bidIndex > bidCount || entry.bidCount > bidCount - entry.bidIndex) {
+                return false;
+            }
+            if ((entry.proxyBidder != NO_ID && entry.proxyBidder >= users.size()) || entry.format > (uint32_t)AuctionFormat::Dutch) {
+                return false;
+            }
+            AuctionRules rules{(AuctionFormat)entry.format, entry.ruleIncrement};
+            ItemId itemId = restoreAuction(displayId, entry.sellerId, name, description, entry.startingPrice, entry.reservePrice,
+                                           entry.startWall, entry.endWall, entry.active != 0, rules, bidPool + entry.bidIndex, entry.bidCount);
+            auctions[itemId].restoreProxy(ProxyBid{entry.proxyBidder, entry.proxyMax, entry.proxyIncrement});
+        }
+        
+        searchIndex.reserve(header->termCount);
+        for (uint32_t i = 0; i < header->termCount && valid; i++) {
+            const SnapshotTerm& entry = termTable[i];
+            string term = getString(entry.term);
+            if (!valid || entry.postingsIndex > postingCount || entry.postingsCount > postingCount - entry.postingsIndex) {
+                return false;
+            }
+            const ItemId* postings = postingPool + entry.postingsIndex;
+            searchIndex[term].assign(postings, postings + entry.postingsCount);
+        }
+        
+        updateNextExpiry();
+        snapshotMapping = move(mapping);
+        return valid;
+    }
+    
+    void reportSummary(const vector<Settlement>& settled) const {
+        SettlementSummary summary;
+        for (const auto& settlement : settled) {
+            summary.add(settlement);
+        }
+        cout << "\n=== " << summary.closed << " Auctions Ended ===" << endl;
+        cout << "Sold: " << summary.sold << " | Reserve not met: " << summary.reserveNotMet
+             << " | No bids: " << summary.noBids << endl;
+        cout << "Total sales: $" << summary.revenue << endl;
+    }
+    
+    void reportSettlement(const Settlement& settlement) const {
+        cout << "\n=== Auction Ended ===" << endl;
+        
+        switch (settlement.status) {
+            case SettlementStatus::NoBids:
+                cout << "No bids were placed. Item remains unsold." << endl;
+                break;
+            case SettlementStatus::ReserveNotMet:
+                cout << "Reserve price not met. Item remains unsold." << endl;
+                cout << "Highest bid: $" << settlement.price << " by " << userIds.name(settlement.winner) << endl;
+                break;
+            case SettlementStatus::Sold:
+                cout << "Item sold to " << userIds.name(settlement.winner) << " for $" << settlement.price << endl;
+                break;
+        }
+    }
+    
+public:
+    ~AuctionSystem() {
+        disableSharding();
+    }
+    
+    
+    // Resolves a display ID typed by the user; NO_ID if there is no such auction
+    ItemId findItem(const string& itemId) const {
+        shared_lock<shared_mutex> guard(catalogLock);
+        return itemIds.find(itemId);
+    }
+    
+    
+    size_t auctionCount() const {
+        return auctions.size();
+    }
+    
+    
+    const string& itemName(ItemId itemId) const {
+        return itemIds.name(itemId);
+    }
+    
+    
+    const string& userName(UserId userId) const {
+        return userIds.name(userId);
+    }
+    
+    
+    // The name the user logs in with, as opposed to the display ID above
+    const string& loginName(UserId userId) const {
+        return users[userId].username;
+    }
+    
+    
+    // Registers a user without printing anything; returns NO_ID if the username is taken
+    UserId addUser(const string& username, const string& email, double initialBalance) {
+        unique_lock<shared_mutex> guard(catalogLock);
+        string displayId = generateId();
+        
+        if (usernameIndex.find(username) != usernameIndex.end()) {
+            return NO_ID;
+        }
+        
+        if (wal) {
+            BinaryWriter record;
+            record.putString(displayId);
+            record.putString(username);
+            record.putString(email);
+            record.put(initialBalance);
+            wal->append(WalRecordType::RegisterUser, record);
+        }
+        
+        UserId userId = userIds.intern(displayId);
+        users.emplace_back(userId, username, email, initialBalance);
+        usernameIndex.emplace(username, userId);
+        return userId;
+    }
+
+
+    // User Management
+    bool registerUser(const string& username, const string& email, double initialBalance = 1000.0) {
+        UserId userId = addUser(username, email, initialBalance);
+        if (userId == NO_ID) {
+            cout << "Username already exists!" << endl;
+            return false;
+        }
+        
+        cout << "User registered successfully! User ID: " << userIds.name(userId) << endl;
+        return true;
+    }
+
+
+    // Loads users from lines of "<username> <email> [balance]".
+    // Returns the number of users registered; duplicates and malformed lines are skipped.
+    size_t registerUsersFromStream(istream& in, size_t expectedUsers = 0) {
+        if (expectedUsers > 0) {
+            unique_lock<shared_mutex> guard(catalogLock);
+            userIds.reserve(userIds.size() + expectedUsers);
+            usernameIndex.reserve(usernameIndex.size() + expectedUsers);
+        }
+        
+        string line, username, email;
+        size_t registered = 0;
+        while (getline(in, line)) {
+            if (line.empty() || line[0] == '#') {
+                continue;
+            }
+            const char* p = nextToken(line.c_str(), username);
+            p = nextToken(p, email);
+            double balance = 1000.0;
+            bool ok = true;
+            if (*skipSpaces(p)) {
+                nextNumber(p, balance, ok);
+            }
+            if (!ok || username.empty() || email.empty()) {
+                continue;
+            }
+            if (addUser(username, email, balance) != NO_ID) {
+                registered++;
+            }
+        }
+        return registered;
+    }
+
+
+    // Returns a session for the user, or a logged-out session if there is no such user
+    Session openSession(const string& username) const {
+        shared_lock<shared_mutex> guard(catalogLock);
+        Session session;
+        auto it = usernameIndex.find(username);
+        if (it != usernameIndex.end()) {
+            session.userId = it->second;
+        }
+        return session;
+    }
+
+
+    bool loginUser(const string& username) {
+        Session session = openSession(username);
+        if (!session.loggedIn()) {
+            cout << "User not found!" << endl;
+            return false;
+        }
+        consoleSession = session;
+        cout << "Login successful! Welcome " << username << endl;
+        return true;
+    }
+
+
+    void logoutUser() {
+        consoleSession = Session();
+        cout << "Logged out successfully!" << endl;
+    }
+
+    // Creates an auction owned by the session's user; returns NO_ID when not logged in
+    ItemId addAuction(const Session& session, const string& itemName, const string& description,
+                      double startingPrice, double reservePrice, int durationMinutes,
+                      const AuctionRules& rules = AuctionRules()) {
+        if (!session.loggedIn()) {
+            return NO_ID;
+        }
+        
+        auto started = metricsClock();
+        unique_lock<shared_mutex> guard(catalogLock);
+        string displayId = generateId();
+        Item item((ItemId)itemIds.size(), itemName, description);
+        auto endTime = item.startTime + minutes(durationMinutes);
+        
+        // Logged before the auction becomes visible so no bid on it can precede this record
+        if (wal) {
+            BinaryWriter record;
+            record.putString(displayId);
+            record.put(session.userId);
+            record.putString(itemName);
+            record.putString(description);
+            record.put(startingPrice);
+            record.put(reservePrice);
+            record.put(toWallMillis(item.startTime));
+            record.put(toWallMillis(endTime));
+            record.put((uint8_t)rules.format);
+            record.put(rules.increment);
+            wal->append(WalRecordType::CreateAuction, record);
+        }
+        
+        ItemId itemId = itemIds.intern(displayId);
+        items.emplace_back(item);
+        Auction& auction = auctions.emplace_back(hotRecords.emplace_back(startingPrice, reservePrice, session.userId, endTime));
+        auction.setRules(rules, item.startTime);
+        
+        User& seller = users[session.userId];
+        {
+            lock_guard<mutex> sellerGuard(seller.lock);
+            seller.addCreatedAuction(itemId);
+        }
+        
+        addActive(itemId);
+        updateNextExpiry();
+        indexItem(items[itemId]);
+        recordOp(MetricOp::CreateAuction, started);
+        return itemId;
+    }
+
+
+    bool createAuction(const string& itemName, const string& description,double startingPrice, double reservePrice, int durationMinutes,
+                       const AuctionRules& rules = AuctionRules()) {
+        ItemId itemId = addAuction(consoleSession, itemName, description, startingPrice, reservePrice, durationMinutes, rules);
+        if (itemId == NO_ID) {
+            cout << "Please login first!" << endl;
+            return false;
+        }
+        
+        cout << "Auction created successfully! Item ID: " << itemIds.name(itemId) << endl;
+        return true;
+    }
+
+
+    // Places a bid without producing any output. Safe to call concurrently.
+    // With sharding enabled the bid is handed to the owning shard's worker
+    // and this call waits for its result; use submitBidAsync to pipeline.
+    BidResult submitBid(const Session& session, ItemId itemId, double amount, bool proxy = false) {
+        if (!session.loggedIn() || itemId >= auctions.size()) {
+            BidResult result(session.loggedIn() ? BidStatus::AuctionNotFound : BidStatus::NotLoggedIn, amount);
+            recordBid(result, metricsClock());
+            return result;
+        }
+        
+        BidResult admitted = admitBid(session, amount);
+        if (!admitted.accepted()) {
+            recordBid(admitted, metricsClock());
+            return admitted;
+        }
+        
+        if (shardEngine) {
+            return shardEngine->call(session, itemId, amount, proxy);
+        }
+        
+        Auction& auction = auctions[itemId];
+        lock_guard<mutex> guard(auction.lock);
+        return applyBidLocked(auction, session, itemId, amount, proxy);
+    }
+
+
+    // Applies a burst of bids together, one result per command in order.
+    // Bids on the same auction are grouped, so the auction is locked once and
+    // dominated plain bids are answered without being applied (see
+    // applyHighestFirst). Only session, itemId, amount and proxy are read.
+    vector<BidResult> submitBids(const vector<BidCommand>& commands) {
+        vector<BidResult> results(commands.size(), BidResult(BidStatus::AuctionNotFound, 0.0));
+        vector<BidCommand> admitted;
+        vector<uint32_t> slots; // admitted[i] answers commands[slots[i]]
+        admitted.reserve(commands.size());
+        slots.reserve(commands.size());
+        for (uint32_t i = 0; i < commands.size(); i++) {
+            const BidCommand& command = commands[i];
+            BidResult admission = command.session.loggedIn() ? admitBid(command.session, command.amount)
+                                                             : BidResult(BidStatus::NotLoggedIn, command.amount);
+            if (!admission.accepted()) {
+                results[i] = admission;
+                recordBid(admission, metricsClock());
+                continue;
+            }
+            admitted.push_back(command);
+            admitted.back().reply = nullptr;
+            slots.push_back(i);
+        }
+        
+        vector<BidResult> applied;
+        if (!shardEngine) {
+            applyShardBatch(0, admitted, applied);
+        } else {
+            vector<promise<BidResult>> replies(admitted.size());
+            for (size_t i = 0; i < admitted.size(); i++) {
+                admitted[i].reply = &replies[i];
+                shardEngine->submit(admitted[i]);
+            }
+            for (auto& reply : replies) {
+                applied.push_back(reply.get_future().get());
+            }
+        }
+        for (size_t i = 0; i < slots.size(); i++) {
+            results[slots[i]] = applied[i];
+        }
+        return results;
+    }
+
+
+    // Lets the auction bid for the user up to maxAmount, one increment above
+    // any rival (see setProxyIncrement). Safe to call concurrently.
+    BidResult submitProxyBid(const Session& session, ItemId itemId, double maxAmount) {
+        return submitBid(session, itemId, maxAmount, true);
+    }
+
+
+    // Step proxies outbid rivals by; applies to proxies registered afterwards
+    void setProxyIncrement(double increment) {
+        proxyIncrement = increment;
+    }
+
+
+    // Admits at most `burst` bids at once per user, refilled at `rate` per
+    // second; bids over it are answered RateLimited. A rate of 0 lifts the limit.
+    void setBidRateLimit(double rate, double burst) {
+        bidBurst = max(1.0, burst);
+        bidRate = max(0.0, rate);
+    }
+
+
+    // Queues a bid on its shard; the result goes to the Completion passed to
+    // enableSharding. Returns false when sharding is not enabled.
+    bool submitBidAsync(const Session& session, ItemId itemId, double amount, uint64_t tag = 0) {
+        if (!shardEngine) {
+            return false;
+        }
+        BidCommand command{session, itemId, amount, tag, nullptr};
+        BidResult admitted = session.loggedIn() ? admitBid(session, amount) : BidResult(BidStatus::Accepted, amount);
+        if (!admitted.accepted()) {
+            recordBid(admitted, metricsClock());
+            shardEngine->complete(command, admitted);
+            return true;
+        }
+        shardEngine->submit(command);
+        return true;
+    }
+
+
+    // Starts one worker per shard. Auctions are partitioned by item ID hash
+    // and each worker is the only writer for its partition.
+    void enableSharding(size_t shardCount, ShardedBidEngine::Completion completion = nullptr, bool pinThreads = false) {
+        disableSharding();
+        shardEngine = make_unique<ShardedBidEngine>(
+            shardCount,
+            [this](size_t shard, const vector<BidCommand>& batch, vector<BidResult>& results) {
+                applyShardBatch(shard, batch, results);
+            },
+            std::move(completion), pinThreads);
+    }
+
+
+    // Applies everything still queued and stops the shard workers
+    void disableSharding() {
+        if (shardEngine) {
+            shardEngine->drain();
+            shardEngine.reset();
+        }
+    }
+
+
+    ShardedBidEngine* getShardEngine() {
+        return shardEngine.get();
+    }
+
+
+    BidResult placeBid(const Session& session, ItemId itemId, double amount) {
+        BidResult result = submitBid(session, itemId, amount);
+        bidReporter.report(result);
+        return result;
+    }
+
+
+    BidResult placeBid(const string& itemId, double amount) {
+        return placeBid(consoleSession, findItem(itemId), amount);
+    }
+
+
+    BidResult placeProxyBid(const string& itemId, double maxAmount) {
+        BidResult result = submitProxyBid(consoleSession, findItem(itemId), maxAmount);
+        bidReporter.report(result);
+        return result;
+    }
+
+
+    BidReporter& getBidReporter() {
+        return bidReporter;
+    }
+
+
+    // Prometheus text exposition of the counters, latencies and table sizes.
+    // Per-auction bid rates cover the time since the previous call and list
+    // the busiest auctions only.
+    string renderMetrics() const {
+        ostringstream out;
+#ifdef AUCTION_METRICS
+        static constexpr size_t RATE_TOP = 10;
+        Metrics::Totals totals;
+        metrics.collect(totals);
+        
+        out << "# TYPE auction_bids_total counter" << endl;
+        for (size_t status = 0; status < Metrics::STATUS_COUNT; status++) {
+            out << "auction_bids_total{result=\"" << Metrics::statusName(status) << "\"} " << totals.bids[status] << endl;
+        }
+        out << "# TYPE auction_settlements_total counter" << endl;
+        for (size_t status = 0; status < Metrics::SETTLEMENT_COUNT; status++) {
+            out << "auction_settlements_total{status=\"" << Metrics::settlementName(status) << "\"} " << totals.settlements[status] << endl;
+        }
+        out << "# TYPE auction_op_latency_seconds summary" << endl;
+        for (size_t op = 0; op < Metrics::OP_COUNT; op++) {
+            const LatencyHistogram& latency = totals.latency[op];
+            for (double quantile : {0.5, 0.9, 0.99, 0.999}) {
+                out << "auction_op_latency_seconds{op=\"" << Metrics::opName(op) << "\",quantile=\"" << quantile << "\"} "
+                    << latency.percentile(quantile) * 1e-9 << endl;
+            }
+            out << "auction_op_latency_seconds_sum{op=\"" << Metrics::opName(op) << "\"} " << totals.latencySum[op] * 1e-9 << endl;
+            out << "auction_op_latency_seconds_count{op=\"" << Metrics::opName(op) << "\"} " << latency.count() << endl;
+        }
+        
+        vector<pair<double, ItemId>> rates;
+        {
+            shared_lock<shared_mutex> guard(catalogLock);
+            out << "# TYPE auction_entries gauge" << endl;
+            out << "auction_entries{table=\"users\"} " << users.size() << endl;
+            out << "auction_entries{table=\"auctions\"} " << auctions.size() << endl;
+            out << "auction_entries{table=\"active_auctions\"} " << activeItems.size() << endl;
+            out << "auction_entries{table=\"expiry_queue\"} " << expiryQueue.size() << endl;
+            out << "auction_entries{table=\"search_terms\"} " << searchIndex.size() << endl;
+            out << "auction_entries{table=\"usernames\"} " << usernameIndex.size() << endl;
+            out << "auction_entries{table=\"archived_auctions\"} " << archivedCount << endl;
+            
+            ScanQuery open;
+            open.now = Clock::now().time_since_epoch().count();
+            size_t openCount = countCatalog(open);
+            open.reserveMet = true;
+            size_t reserveMet = countCatalog(open);
+            out << "# TYPE auction_open_auctions gauge" << endl;
+            out << "auction_open_auctions{reserve=\"met\"} " << reserveMet << endl;
+            out << "auction_open_auctions{reserve=\"not_met\"} " << openCount - reserveMet << endl;
+            
+            lock_guard<mutex> rateGuard(rateLock);
+            auto now = steady_clock::now();
+            double elapsed = duration<double>(now - rateSampleTime).count();
+            bool haveSample = rateSampleTime != time_point<steady_clock>();
+            rateBidCounts.resize(auctions.size(), 0);
+            for (ItemId itemId = 0; itemId < auctions.size(); itemId++) {
+                const Auction& auction = auctions[itemId];
+                uint32_t count;
+                {
+                    lock_guard<mutex> auctionGuard(auction.lock);
+                    count = (uint32_t)auction.getBidCount();
+                }
+                if (haveSample && elapsed > 0 && count != rateBidCounts[itemId]) {
+                    rates.push_back({(count - rateBidCounts[itemId]) / elapsed, itemId});
+                }
+                rateBidCounts[itemId] = count;
+            }
+            rateSampleTime = now;
+        }
+        size_t shown = min(RATE_TOP, rates.size());
+        partial_sort(rates.begin(), rates.begin() + shown, rates.end(), greater<pair<double, ItemId>>());
+        out << "# TYPE auction_bid_rate gauge" << endl;
+        for (size_t i = 0; i < shown; i++) {
+            out << "auction_bid_rate{item=\"" << itemIds.name(rates[i].second) << "\"} " << rates[i].first << endl;
+        }
+#else
+        out << "# metrics disabled; rebuild with -DAUCTION_METRICS" << endl;
+#endif
+        return out.str();
+    }
+
+
+    // One-line digest for periodic logging
+    string metricsLogLine() const {
+        ostringstream out;
+#ifdef AUCTION_METRICS
+        Metrics::Totals totals;
+        metrics.collect(totals);
+        uint64_t bids = 0;
+        for (uint64_t count : totals.bids) {
+            bids += count;
+        }
+        const LatencyHistogram& latency = totals.latency[(size_t)MetricOp::PlaceBid];
+        out << "metrics bids=" << bids << " accepted=" << totals.bids[(size_t)BidStatus::Accepted]
+            << " bid_p50=" << latency.percentile(0.5) << "ns bid_p99=" << latency.percentile(0.99) << "ns"
+            << " searches=" << totals.latency[(size_t)MetricOp::Search].count()
+            << " created=" << totals.latency[(size_t)MetricOp::CreateAuction].count();
+        shared_lock<shared_mutex> guard(catalogLock);
+        out << " users=" << users.size() << " auctions=" << auctions.size() << " active=" << activeItems.size();
+#else
+        out << "metrics disabled";
+#endif
+        return out.str();
+    }
+
+
+    // Settles every open auction whose end time has passed and returns the
+    // settlements. Without anything due this is a single atomic load.
+    vector<Settlement> settleExpiredAuctions(time_point<steady_clock> now) {
+        vector<Settlement> settled;
+        if (replica) {
+            return settled; // the leader settles and logs it
+        }
+        if (now.time_since_epoch().count() <= nextExpiry.load(memory_order_acquire)) {
+            return settled;
+        }
+        
+        unique_lock<shared_mutex> guard(catalogLock);
+        vector<ItemId> due;
+        while (!expiryQueue.empty() && expiryQueue.top().first < now) {
+            ItemId itemId = expiryQueue.top().second;
+            expiryQueue.pop();
+            if (activeSlot[itemId] == NO_ID) {
+                continue; // already ended by hand
+            }
+            due.push_back(itemId);
+        }
+        vector<bool> taken(due.size(), false);
+        {
+            // Only a handful at a time, so a linear search keeps out repeats.
+            // A queued auction was taken by a bid even if its time is also up.
+            lock_guard<mutex> closeGuard(closeQueueLock);
+            for (ItemId itemId : closeQueue) {
+                if (activeSlot[itemId] == NO_ID) {
+                    continue;
+                }
+                size_t at = find(due.begin(), due.end(), itemId) - due.begin();
+                if (at == due.size()) {
+                    due.push_back(itemId);
+                    taken.push_back(true);
+                } else {
+                    taken[at] = true;
+                }
+            }
+            closeQueue.clear();
+        }
+        if (!due.empty()) {
+            settled = settleBatch(due);
+            for (size_t i = 0; i < settled.size(); i++) {
+                settled[i].taken = taken[i];
+            }
+        }
+        updateNextExpiry();
+        return settled;
+    }
+
+
+    // Ends every auction in `items` that is still open, expired or not, in
+    // one batch. Unknown, ended and repeated items are skipped.
+    vector<Settlement> closeAuctions(const vector<ItemId>& items) {
+        settleExpiredAuctions(Clock::now());
+        
+        unique_lock<shared_mutex> guard(catalogLock);
+        vector<ItemId> open;
+        open.reserve(items.size());
+        for (ItemId itemId : items) {
+            if (itemId < auctions.size() && activeSlot[itemId] != NO_ID) {
+                open.push_back(itemId);
+            }
+        }
+        sort(open.begin(), open.end());
+        open.erase(unique(open.begin(), open.end()), open.end());
+        vector<Settlement> settled = settleBatch(open);
+        updateNextExpiry();
+        return settled;
+    }
+
+
+    // Console variant: settles and reports expired auctions, and Dutch
+    // auctions a bid has taken.
+    // Returns the number of auctions closed.
+    // Large batches get a single summary instead of a report per auction.
+    size_t closeExpiredAuctions(time_point<steady_clock> now) {
+        static constexpr size_t DETAILED_REPORT_LIMIT = 10;
+        vector<Settlement> settled = settleExpiredAuctions(now);
+        if (settled.size() > DETAILED_REPORT_LIMIT) {
+            reportSummary(settled);
+            return settled.size();
+        }
+        for (const auto& settlement : settled) {
+            if (settlement.taken) {
+                cout << "\nAuction " << itemIds.name(settlement.item) << " was taken by a bid." << endl;
+            } else {
+                cout << "\nAuction " << itemIds.name(settlement.item) << " expired." << endl;
+            }
+            reportSettlement(settlement);
+        }
+        return settled.size();
+    }
+
+
+    size_t closeExpiredAuctions() {
+        return closeExpiredAuctions(Clock::now());
+    }
+
+
+    void displayActiveAuctions() {
+        auto now = Clock::now();
+        closeExpiredAuctions(now);
+        
+        cout << "\n=== Active Auctions ===" << endl;
+        
+        // One pass over the hot records finds the open auctions in ItemId
+        // order; prices come from the same records, so no auction lock is taken
+        shared_lock<shared_mutex> guard(catalogLock);
+        ScanQuery query;
+        query.now = now.time_since_epoch().count();
+        vector<ItemId> open = scanCatalog(query);
+        for (ItemId itemId : open) {
+            const AuctionHot& hot = hotRecords[itemId];
+            cout << "ID: " << itemIds.name(itemId) << " | " << items[itemId].name << " | Current Price: $" << hot.view().price << " | Time Left: " << hot.getRemainingSeconds(now) << "s" << endl;
+        }
+        
+        if (open.empty()) {
+            cout << "No active auctions available." << endl;
+        }
+    }
+
+
+    void displayAuctionDetails(const string& itemId) const {
+        ItemId id = findItem(itemId);
+        if (id == NO_ID) {
+            cout << "Auction not found!" << endl;
+            return;
+        }
+        
+        auctions[id].displayAuctionInfo(items[id], itemIds, userIds);
+    }
+
+
+    void displayUserProfile() const {
+        if (!consoleSession.loggedIn()) {
+            cout << "Please login first!" << endl;
+            return;
+        }
+        
+        const User& user = users[consoleSession.userId];
+        lock_guard<mutex> guard(user.lock);
+        cout << "\n=== User Profile ===" << endl;
+        cout << "Username: " << user.username << endl;
+        cout << "Email: " << user.email << endl;
+        cout << "Balance: $" << user.balance << endl;
+        cout << "Reserved for Bids: $" << user.reserved << " (available: $" << user.available() << ")" << endl;
+        cout << "Bids Placed: " << user.bidHistory.size() << endl;
+        cout << "Items Owned: " << user.ownedItems.size() << endl;
+        cout << "Items Sold: " << user.soldItems.size() << endl;
+        
+        if (!user.createdAuctions.empty()) {
+            cout << "Auctions Created: " << user.createdAuctions.size() << endl;
+        }
+    }
+
+
+    // Prints bids newest (and so highest) first, skipping `offset` of them and
+    // showing at most `limit` (0 for all)
+    void displayBidHistory(const string& itemId, size_t offset = 0, size_t limit = 0) const {
+        ItemId id = findItem(itemId);
+        if (id == NO_ID) {
+            cout << "Auction not found!" << endl;
+            return;
+        }
+        
+        cout << "\n=== Bid History for " << itemId << " ===" << endl;
+        
+        // The page points into the log, so it is printed under the auction lock
+        const Auction& auction = auctions[id];
+        lock_guard<mutex> guard(auction.lock);
+        if (auction.bidsSealed()) {
+            cout << "Bids are sealed until the auction ends." << endl;
+            return;
+        }
+        if (!auction.hasBids()) {
+            cout << "No bids placed yet." << endl;
+            return;
+        }
+        
+        vector<Bid> archived;
+        BidSpan page = historyPage(auction, offset, limit, archived);
+        size_t rank = offset + 1;
+        for (auto it = page.rbegin(); it != page.rend(); ++it) {
+            const Bid& bid = *it;
+            cout << rank++ << ". User: " << userIds.name(bid.bidder)
+                 << " | Amount: $" << bid.amount 
+                 << " | Time: " << duration_cast<seconds>(bid.timestamp.time_since_epoch()).count() % 10000 << endl;
+        }
+    }
+
+
+    // Current state of one auction for remote clients; false if there is no such item
+    bool quoteAuction(ItemId itemId, AuctionQuote& quote) const {
+        if (itemId >= auctions.size()) {
+            return false;
+        }
+        const AuctionHot& hot = hotRecords[itemId];
+        AuctionView view = hot.view();
+        auto now = Clock::now();
+        quote.price = view.price;
+        quote.bidCount = view.bidCount;
+        quote.leader = view.bidCount > 0 ? view.leader : NO_ID;
+        quote.active = view.isActive && !hot.isExpired(now);
+        quote.remainingSeconds = hot.getRemainingSeconds(now);
+        // Rules are fixed at creation, so reading them needs no lock
+        const Auction& auction = auctions[itemId];
+        if (auction.getRules().format == AuctionFormat::Dutch && quote.active && view.bidCount == 0) {
+            quote.price = auction.clockPrice(now);
+        }
+        return true;
+    }
+
+
+    // Starts an event feed reader. The returned cursor sees events published
+    // from now on; pass it to readEvents and finally to unsubscribeEvents.
+    uint64_t subscribeEvents() {
+        eventSubscribers.fetch_add(1, memory_order_relaxed);
+        return eventRing.head();
+    }
+
+
+    void unsubscribeEvents() {
+        eventSubscribers.fetch_sub(1, memory_order_relaxed);
+    }
+
+
+    // Lock-free; returns how many events the reader missed by falling behind
+    uint64_t readEvents(uint64_t& cursor, vector<AuctionEvent>& out, size_t limit = EventRing::CAPACITY) const {
+        return eventRing.read(cursor, out, limit);
+    }
+
+
+    // Publishes what changed since the previous call, one update per auction:
+    // PriceChanged, Outbid for whoever led when the auction was queued if they
+    // no longer do, and Closed or Sold if it ended. Meant to run once per tick.
+    size_t publishEvents() {
+        lock_guard<mutex> publishGuard(publishLock);
+        vector<ItemId> due;
+        {
+            lock_guard<mutex> guard(eventQueueLock);
+            due.swap(eventQueue);
+        }
+        
+        size_t published = 0;
+        for (ItemId itemId : due) {
+            Auction& auction = auctions[itemId];
+            AuctionEvent events[3];
+            size_t count = 0;
+            {
+                lock_guard<mutex> guard(auction.lock);
+                auction.eventQueued = false;
+                uint32_t bidCount = (uint32_t)auction.getBidCount();
+                UserId leader = auction.hasBids() ? auction.getHighestBid().bidder : NO_ID;
+                double price = auction.getCurrentPrice();
+                if (bidCount != auction.eventBidCount) {
+                    events[count++] = AuctionEvent{0, itemId, AuctionEventKind::PriceChanged, leader, price, bidCount};
+                    if (auction.eventLeader != NO_ID && auction.eventLeader != leader) {
+                        events[count++] = AuctionEvent{0, itemId, AuctionEventKind::Outbid, auction.eventLeader, price, bidCount};
+                    }
+                }
+                if (!auction.getHot().isActive) {
+                    bool sold = auction.hasBids() && auction.hasReserveBeenMet();
+                    events[count++] = AuctionEvent{0, itemId, sold ? AuctionEventKind::Sold : AuctionEventKind::Closed, leader, price, bidCount};
+                }
+            }
+            for (size_t i = 0; i < count; i++) {
+                eventRing.publish(events[i]);
+            }
+            published += count;
+        }
+        return published;
+    }
+
+
+    // Ends an open auction and settles it. Returns false if it had already ended.
+    bool closeAuction(ItemId itemId, Settlement& settlement) {
+        settleExpiredAuctions(Clock::now());
+        
+        unique_lock<shared_mutex> guard(catalogLock);
+        if (itemId >= auctions.size() || activeSlot[itemId] == NO_ID) {
+            return false;
+        }
+        settlement = settleAuction(itemId);
+        return true;
+    }
+
+
+    void endAuction(const string& itemId) {
+        ItemId id = findItem(itemId);
+        if (id == NO_ID) {
+            cout << "Auction not found!" << endl;
+            return;
+        }
+        
+        closeExpiredAuctions();
+        
+        Settlement settlement{};
+        if (!closeAuction(id, settlement)) {
+            cout << "Auction already ended!" << endl;
+            return;
+        }
+        
+        reportSettlement(settlement);
+    }
+
+
+    // Console bulk close: ends the listed auctions together and prints one summary
+    void endAuctions(const vector<string>& itemIds) {
+        vector<ItemId> items;
+        for (const auto& itemId : itemIds) {
+            ItemId id = findItem(itemId);
+            if (id == NO_ID) {
+                cout << "Auction not found: " << itemId << endl;
+                continue;
+            }
+            items.push_back(id);
+        }
+        
+        closeExpiredAuctions();
+        reportSummary(closeAuctions(items));
+    }
+
+
+    // Ends every open auction, expired or not, and reports one summary
+    void endAllAuctions() {
+        closeExpiredAuctions();
+        vector<ItemId> open;
+        {
+            shared_lock<shared_mutex> guard(catalogLock);
+            ScanQuery query;
+            query.state = ScanQuery::Any;
+            open = scanCatalog(query);
+        }
+        reportSummary(closeAuctions(open));
+    }
+
+
+    // Adds funds to the session's account; returns the new balance, or -1 when not logged in
+    double addBalance(const Session& session, double amount) {
+        if (!session.loggedIn()) {
+            return -1.0;
+        }
+        
+        User& user = users[session.userId];
+        lock_guard<mutex> guard(user.lock);
+        user.addBalance(amount);
+        if (wal) {
+            BinaryWriter record;
+            record.put(session.userId);
+            record.put(amount);
+            wal->append(WalRecordType::AddBalance, record);
+        }
+        return user.balance;
+    }
+
+
+    // Function to add balance to the user's account
+    void addBalance(double amount) {
+        double balance = addBalance(consoleSession, amount);
+        if (balance < 0) {
+            cout << "Please login first!" << endl;
+            return;
+        }
+        
+        cout << "Balance added successfully! New balance: $" << balance << endl;
+    }
+
+    
+    // Returns the items whose name or description contains every term of the query
+    vector<ItemId> findAuctions(const string& query, const SearchOptions& options = SearchOptions()) const {
+        auto started = metricsClock();
+        vector<ItemId> matches = findAuctionsUnmetered(query, options);
+        recordOp(MetricOp::Search, started);
+        return matches;
+    }
+
+
+    void searchAuctions(const string& keyword, const SearchOptions& options = SearchOptions()) const {
+        cout << "\n=== Search Results for: " << keyword << " ===" << endl;
+        
+        vector<ItemId> matches = findAuctions(keyword, options);
+        auto now = Clock::now();
+        for (ItemId itemId : matches) {
+            const AuctionHot& hot = hotRecords[itemId];
+            AuctionView view = hot.view();
+            cout << "ID: " << itemIds.name(itemId) << " | " << items[itemId].name << " | Current Price: $" << view.price << " | Status: " << (view.isActive && !hot.isExpired(now) ? "Active" : "Ended") << endl;
+        }
+        
+        if (matches.empty()) {
+            cout << "No auctions found matching: " << keyword << endl;
+        }
+    }
+
+    // One page of open auctions in a price range, read from the browse indexes.
+    // Ending-soonest pages come from a walk of the price range when that is
+    // short, and otherwise from the end-time index filtered by price, which
+    // can stop at the end of the page.
+    vector<ItemId> browseAuctions(const BrowseOptions& options) {
+        settleExpiredAuctions(Clock::now());
+        
+        shared_lock<shared_mutex> catalogGuard(catalogLock);
+        lock_guard<mutex> guard(browseLock);
+        refreshPriceIndex();
+        
+        size_t wanted = options.limit == 0 ? numeric_limits<size_t>::max() : options.offset + options.limit;
+        auto low = priceIndex.lower_bound({options.minPrice, 0});
+        auto high = priceIndex.upper_bound({options.maxPrice, NO_ID});
+        vector<ItemId> page;
+        auto take = [&](ItemId itemId, size_t& seen) {
+            if (seen++ >= options.offset) {
+                page.push_back(itemId);
+            }
+            return seen < wanted;
+        };
+        size_t seen = 0;
+        
+        switch (options.order) {
+            case BrowseOrder::PriceLowest:
+                for (auto it = low; it != high && take(it->second, seen); ++it) {}
+                break;
+                
+            case BrowseOrder::PriceHighest:
+                for (auto it = make_reverse_iterator(high); it != make_reverse_iterator(low) && take(it->second, seen); ++it) {}
+                break;
+                
+            case BrowseOrder::EndingSoonest: {
+                // A range holding a small share of the catalog is cheaper to sort
+                // than to find by walking end times
+                size_t scanLimit = max<size_t>(256, endIndex.size() / 8);
+                vector<pair<time_point<steady_clock>, ItemId>> inRange;
+                auto it = low;
+                for (; it != high && inRange.size() <= scanLimit; ++it) {
+                    inRange.emplace_back(hotRecords[it->second].endTime, it->second);
+                }
+                if (it == high) {
+                    sort(inRange.begin(), inRange.end());
+                    for (size_t i = 0; i < inRange.size() && take(inRange[i].second, seen); i++) {}
+                    break;
+                }
+                for (const auto& entry : endIndex) {
+                    double price = indexedPrice[entry.second];
+                    if (price >= options.minPrice && price <= options.maxPrice && !take(entry.second, seen)) {
+                        break;
+                    }
+                }
+                break;
+            }
+        }
+        return page;
+    }
+
+
+    void displayBrowse(const BrowseOptions& options) {
+        vector<ItemId> page = browseAuctions(options);
+        
+        cout << "\n=== Auctions between $" << options.minPrice << " and $" << options.maxPrice << " ===" << endl;
+        auto now = Clock::now();
+        for (ItemId itemId : page) {
+            const AuctionHot& hot = hotRecords[itemId];
+            cout << "ID: " << itemIds.name(itemId) << " | " << items[itemId].name << " | Current Price: $" << hot.view().price << " | Time Left: " << hot.getRemainingSeconds(now) << "s" << endl;
+        }
+        
+        if (page.empty()) {
+            cout << "No active auctions in that range." << endl;
+        }
+    }
+
+
+    void displayTopBidders(const string& itemId) const {
+        ItemId id = findItem(itemId);
+        if (id == NO_ID) {
+            cout << "Auction not found!" << endl;
+            return;
+        }
+        
+        TopBidders bidders;
+        bool sealed;
+        {
+            const Auction& auction = auctions[id];
+            lock_guard<mutex> guard(auction.lock);
+            sealed = auction.bidsSealed();
+            if (!sealed) {
+                bidders = auction.getTopBidders();
+            }
+        }
+        
+        cout << "\n=== Top Bidders for " << itemId << " ===" << endl;
+        if (sealed) {
+            cout << "Bids are sealed until the auction ends." << endl;
+        }
+        int rank = 1;
+        for (const auto& bidder : bidders) {
+            cout << rank++ << ". " << userIds.name(bidder.bidder) << " - $" << bidder.amount << endl;
+        }
+    }
+
+
+    // ---- Persistence ----
+    //
+    // <dataDir>/snapshot.bin holds the full state as of a checkpoint and
+    // <dataDir>/wal.log every accepted change since. Both carry a generation
+    // number; a log is only replayed on top of the snapshot of the same
+    // generation, so a crash between writing a new snapshot and resetting the
+    // log cannot apply records twice.
+
+    // Loads the snapshot, replays the log and starts logging. Call once,
+    // before the system is used.
+    bool enablePersistence(const string& directory) {
+        ::mkdir(directory.c_str(), 0755);
+        dataDir = directory;
+        
+        auto start = steady_clock::now();
+        bool haveSnapshot = loadSnapshot(snapshotPath());
+        if (!haveSnapshot && ifstream(snapshotPath())) {
+            cerr << "Snapshot " << snapshotPath() << " is unreadable" << endl;
+            return false;
+        }
+        
+        uint64_t validSize = 0;
+        size_t replayed = 0;
+        bool haveLog = WriteAheadLog::replay(walPath(), walGeneration, validSize, [&](WalRecordType type, BinaryReader& record) {
+            if (applyLogRecord(type, record)) {
+                replayed++;
+            }
+        });
+        
+        updateNextExpiry();
+        if (!enableArchive(directory + "/archive.bin")) {
+            return false;
+        }
+        
+        wal = make_unique<WriteAheadLog>();
+        if (!wal->open(walPath(), walGeneration, !haveLog, validSize)) {
+            wal.reset();
+            return false;
+        }
+        
+        cerr << "Recovered " << users.size() << " users and " << auctions.size() << " auctions ("
+             << (haveSnapshot ? "snapshot + " : "") << replayed << " log records) in "
+             << duration_cast<milliseconds>(steady_clock::now() - start).count() << " ms" << endl;
+        return true;
+    }
+
+
+    // Spills the bid logs of settled auctions to `path` from now on, keeping
+    // only their final bid in memory; bid history pages are read back from
+    // the file when asked for. Auctions that have already ended are moved at
+    // once. enablePersistence turns this on inside the data directory.
+    bool enableArchive(const string& path) {
+        unique_lock<shared_mutex> guard(catalogLock);
+        if (bidArchive) {
+            return true;
+        }
+        auto archive = make_unique<BidArchive>();
+        if (!archive->open(path)) {
+            return false;
+        }
+        bidArchive = std::move(archive);
+        vector<ItemId> ended;
+        for (ItemId itemId = 0; itemId < auctions.size(); itemId++) {
+            if (!hotRecords[itemId].isActive.load(memory_order_relaxed)) {
+                ended.push_back(itemId);
+            }
+        }
+        archiveAuctions(ended);
+        return true;
+    }
+
+
+    // Writes a snapshot of the current state and starts a fresh log.
+    // Must run without concurrent callers; with sharding enabled the shard
+    // queues are drained first.
+    bool checkpoint() {
+        if (!wal) {
+            return false;
+        }
+        if (shardEngine) {
+            shardEngine->drain();
+        }
+        // Followers were never sent what the log failed to write, so a
+        // snapshot past that point would leave them silently diverged
+        if (wal->hasFailed()) {
+            cerr << "Checkpoint refused: the log failed to reach disk" << endl;
+            return false;
+        }
+        
+        unique_lock<shared_mutex> guard(catalogLock);
+        string tempPath = snapshotPath() + ".tmp";
+        if (!writeSnapshot(tempPath, walGeneration + 1)) {
+            return false;
+        }
+        if (::rename(tempPath.c_str(), snapshotPath().c_str()) != 0) {
+            cerr << "Cannot replace snapshot: " << strerror(errno) << endl;
+            return false;
+        }
+        syncDirectory();
+        
+        walGeneration++;
+        return wal->open(walPath(), walGeneration, true);
+    }
+
+
+    // Blocks until every change made so far is durable. False when running
+    // in memory only or when the log failed to write them.
+    bool syncLog() {
+        return wal && wal->sync();
+    }
+
+
+    // ---- Replication ----
+    //
+    // The log already orders every change, so it is also what keeps followers
+    // in step. A follower starts from a fresh snapshot of the leader and then
+    // applies the leader's records as they become durable there, the way
+    // recovery replays them. It never changes on its own: it takes no
+    // writes, and its auctions end when the leader's Settle records arrive.
+
+    // Hands every batch of log records to `shipper` once it is on disk, on
+    // the log's flusher thread. False when running in memory only.
+    bool setLogShipper(function<void(const string&)> shipper) {
+        if (!wal) {
+            return false;
+        }
+        wal->setShipper(move(shipper));
+        return true;
+    }
+
+
+    // Checkpoints and reads back the snapshot a new follower starts from.
+    // Records logged after this call are the ones the follower must apply.
+    bool replicaSnapshot(string& contents) {
+        if (!checkpoint()) {
+            return false;
+        }
+        ifstream in(snapshotPath(), ios::binary);
+        contents.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+        return in.good() || in.eof();
+    }
+
+
+    // Turns this empty, in-memory system into a follower of the leader whose
+    // snapshot is at `path`. The file may be removed once this returns.
+    bool startReplica(const string& path) {
+        if (wal || users.size() > 0 || auctions.size() > 0 || !loadSnapshot(path)) {
+            return false;
+        }
+        replica = true;
+        return true;
+    }
+
+
+    // Applies the complete records at the front of `records` and removes
+    // them, keeping a partial record for the next batch. Records that do not
+    // apply are skipped, as in recovery. False if a complete record is corrupt.
+    bool applyReplicated(string& records) {
+        size_t skipped = 0;
+        size_t used = WriteAheadLog::parse(records.data(), records.size(), [&](WalRecordType type, BinaryReader& record) {
+            if (!applyLogRecord(type, record)) {
+                skipped++;
+            }
+        });
+        if (skipped > 0) {
+            cerr << "Skipped " << skipped << " replicated records that did not apply" << endl;
+        }
+        records.erase(0, used);
+        uint32_t length = 0;
+        if (records.size() >= 8) {
+            memcpy(&length, records.data(), 4);
+        }
+        return records.size() < 8 || (length != 0 && records.size() - 8 < length);
+    }
+
+
+    bool isReplica() const {
+        return replica;
+    }
+
+
+    void displayMenu() const {
+        cout << "\n=== Auction System Menu ===" << endl;
+        cout << "1. Register User" << endl;
+        cout << "2. Login" << endl;
+        cout << "3. Logout" << endl;
+        cout << "4. Create Auction" << endl;
+        cout << "5. Place Bid" << endl;
+        cout << "6. View Active Auctions" << endl;
+        cout << "7. View Auction Details" << endl;
+        cout << "8. View User Profile" << endl;
+        cout << "9. View Bid History" << endl;
+        cout << "10. End Auction" << endl;
+        cout << "11. Add Balance" << endl;
+        cout << "12. Search Auctions" << endl;
+        cout << "13. View Top Bidders" << endl;
+        cout << "14. Place Proxy Bid" << endl;
+        cout << "0. Exit" << endl;
+        cout << "Choice: ";
+    }
+
+
+
+    void run() {
+        int choice;
+        string input, username, email, itemName, description, itemId, keyword;
+        double startingPrice, reservePrice, amount;
+        int duration;
+        
+        cout << "Welcome to Advanced Auction System!" << endl;
+        
+        while (true) {
+            displayMenu();
+            cin >> choice;
+            cin.ignore(); // Clear input buffer
+            closeExpiredAuctions();
+            
+            switch (choice) {
+                case 1:
                     cout << "Enter username: ";
                     getline(cin, username);
                     cout << "Enter email: ";
@@ -525,6 +5184,11 @@ public:
                     cin >> reservePrice;
                     cout << "Enter duration (minutes): ";
                     cin >> duration;
+                    if (!cin || duration <= 0 || duration > MAX_AUCTION_MINUTES) {
+                        cin.clear();
+                        cout << "Duration must be between 1 and " << MAX_AUCTION_MINUTES << " minutes!" << endl;
+                        break;
+                    }
                     createAuction(itemName, description, startingPrice, reservePrice, duration);
                     break;
                     
@@ -567,34 +5231,1835 @@ public:
                     cin >> amount;
                     addBalance(amount);
                     break;
-                    
-                case 12:
-                    cout << "Enter search keyword: ";
-                    getline(cin, keyword);
-                    searchAuctions(keyword);
+                    
+                case 12:
+                    cout << "Enter search keyword: ";
+                    getline(cin, keyword);
+                    searchAuctions(keyword);
+                    break;
+                    
+                case 13:
+                    cout << "Enter item ID: ";
+                    getline(cin, itemId);
+                    displayTopBidders(itemId);
+                    break;
+                    
+                case 14:
+                    cout << "Enter item ID: ";
+                    getline(cin, itemId);
+                    cout << "Enter maximum bid: $";
+                    cin >> amount;
+                    placeProxyBid(itemId, amount);
+                    break;
+                    
+                case 0:
+                    cout << "Thank you for using Advanced Auction System!" << endl;
+                    return;
+                    
+                default:
+                    cout << "Invalid choice! Please try again." << endl;
+            }
+        }
+    }
+
+
+    // Batch mode: executes one command per line without the menu.
+    //
+    //   R <username> <email> [balance]      register user
+    //   L <username>                        login
+    //   O                                   logout
+    //   C <start> <reserve> <minutes> <name>|<description>[|<format>]
+    //                                       create auction; format is english (default),
+    //                                       increment:<amount>, sealed, vickrey or dutch
+    //   B <itemId> <amount>                 place bid
+    //   P <itemId> <maximum>                proxy bid: most you will pay
+    //   E <itemId>... | *                   end auctions (several IDs or all: one summary)
+    //   A <amount>                          add balance
+    //   S <keywords>                        search auctions (all terms must match)
+    //   V <low> <high> [offset] [limit]     open auctions priced low..high, ending soonest
+    //   H <itemId> [offset] [limit]         bid history page
+    //   M                                   print metrics (Prometheus text)
+    //   K                                   checkpoint (snapshot + fresh log) when persistent
+    //   T <seconds> [epoch-ms]              logical time since the stream began (see CommandRecorder)
+    //
+    // Blank lines and lines starting with '#' are ignored. Once a T line is
+    // seen, Clock is pinned to the stream's logical time until the batch ends.
+    // Executed commands are passed on to `recorder`, and their latency to
+    // `stats`, when given. Returns the number of commands executed.
+    size_t runBatch(istream& in, CommandRecorder* recorder = nullptr, BatchStats* stats = nullptr) {
+        string line;
+        size_t lineNumber = 0;
+        size_t executed = 0;
+
+        while (getline(in, line)) {
+            lineNumber++;
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            if (line.empty() || line[0] == '#') {
+                continue;
+            }
+
+            closeExpiredAuctions();
+            auto started = stats ? steady_clock::now() : time_point<steady_clock>();
+            if (executeBatchCommand(line)) {
+                executed++;
+                if (line[0] != 'T') {
+                    if (stats && line[0] >= 'A' && line[0] <= 'Z') {
+                        stats->latency[line[0] - 'A'].record((uint64_t)duration_cast<nanoseconds>(steady_clock::now() - started).count());
+                    }
+                    if (recorder) {
+                        recorder->record(line);
+                    }
+                }
+            } else {
+                cout << "Invalid command at line " << lineNumber << ": " << line << endl;
+            }
+        }
+        if (replayPinned) {
+            Clock::release();
+            replayPinned = false;
+            replayLogical = 0.0;
+        }
+        return executed;
+    }
+
+
+    // How fast runBatch follows T lines: 1 keeps the recorded pace, 2 runs
+    // twice as fast, 0 does not wait at all
+    void setReplaySpeed(double speed) {
+        replaySpeed = max(0.0, speed);
+    }
+
+private:
+    // Replay state for T lines: the real and wall times of logical time 0
+    double replaySpeed = 1.0;
+    bool replayPinned = false;
+    double replayLogical = 0.0; // seconds; never moves backwards
+    time_point<steady_clock> replayStart;
+    time_point<system_clock> replayWallStart;
+    
+    // Waits until `at` seconds of stream time are due at replaySpeed, then
+    // pins Clock there. `epochMillis` (if not negative) is the wall time of
+    // logical 0, restoring the recorded bid timestamps.
+    void advanceReplay(double at, double epochMillis) {
+        if (!replayPinned) {
+            replayStart = steady_clock::now();
+            replayWallStart = system_clock::now();
+            replayPinned = true;
+        }
+        if (epochMillis >= 0) {
+            replayWallStart = time_point<system_clock>(duration_cast<system_clock::duration>(milliseconds((int64_t)epochMillis)));
+        }
+        replayLogical = max(replayLogical, at);
+        if (replaySpeed > 0) {
+            this_thread::sleep_until(replayStart + duration_cast<steady_clock::duration>(duration<double>(replayLogical / replaySpeed)));
+        }
+        auto offset = duration<double>(replayLogical);
+        Clock::pin(replayStart + duration_cast<steady_clock::duration>(offset),
+                   replayWallStart + duration_cast<system_clock::duration>(offset));
+    }
+    
+    static const char* skipSpaces(const char* p) {
+        while (*p == ' ' || *p == '\t') {
+            p++;
+        }
+        return p;
+    }
+
+    // Reads the next whitespace-delimited token starting at p
+    static const char* nextToken(const char* p, string& token) {
+        p = skipSpaces(p);
+        const char* start = p;
+        while (*p && *p != ' ' && *p != '\t') {
+            p++;
+        }
+        token.assign(start, p - start);
+        return p;
+    }
+
+    static const char* nextNumber(const char* p, double& value, bool& ok) {
+        p = skipSpaces(p);
+        char* end = nullptr;
+        value = strtod(p, &end);
+        if (end == p) {
+            ok = false;
+        }
+        return end;
+    }
+
+    bool executeBatchCommand(const string& line) {
+        const char* p = line.c_str();
+        char op = *p++;
+        bool ok = true;
+        string first, second;
+        double amount = 0.0;
+
+        switch (op) {
+            case 'R': {
+                p = nextToken(p, first);
+                p = nextToken(p, second);
+                double balance = 1000.0;
+                if (*skipSpaces(p)) {
+                    p = nextNumber(p, balance, ok);
+                }
+                if (!ok || first.empty() || second.empty()) return false;
+                registerUser(first, second, balance);
+                return true;
+            }
+
+            case 'L':
+                nextToken(p, first);
+                if (first.empty()) return false;
+                loginUser(first);
+                return true;
+
+            case 'O':
+                logoutUser();
+                return true;
+
+            case 'C': {
+                double startingPrice = 0.0, reservePrice = 0.0, duration = 0.0;
+                p = nextNumber(p, startingPrice, ok);
+                p = nextNumber(p, reservePrice, ok);
+                p = nextNumber(p, duration, ok);
+                if (!ok || !(duration > 0 && duration <= MAX_AUCTION_MINUTES) || duration != floor(duration)) return false;
+                p = skipSpaces(p);
+                const char* bar = strchr(p, '|');
+                if (bar == nullptr) return false;
+                first.assign(p, bar - p);
+                second.assign(bar + 1);
+                // A last field that is not a format stays part of the description
+                AuctionRules rules;
+                size_t last = second.rfind('|');
+                if (last != string::npos && parseRules(second.substr(last + 1), rules)) {
+                    second.resize(last);
+                } else {
+                    rules = AuctionRules();
+                }
+                createAuction(first, second, startingPrice, reservePrice, (int)duration, rules);
+                return true;
+            }
+
+            case 'B':
+                p = nextToken(p, first);
+                p = nextNumber(p, amount, ok);
+                if (!ok || first.empty()) return false;
+                placeBid(first, amount);
+                return true;
+
+            case 'P':
+                p = nextToken(p, first);
+                p = nextNumber(p, amount, ok);
+                if (!ok || first.empty()) return false;
+                placeProxyBid(first, amount);
+                return true;
+
+            case 'E': {
+                vector<string> items;
+                for (p = nextToken(p, first); !first.empty(); p = nextToken(p, first)) {
+                    items.push_back(first);
+                }
+                if (items.empty()) return false;
+                if (items.size() == 1 && items[0] == "*") {
+                    endAllAuctions();
+                } else if (items.size() == 1) {
+                    endAuction(items[0]);
+                } else {
+                    endAuctions(items);
+                }
+                return true;
+            }
+
+            case 'A':
+                nextNumber(p, amount, ok);
+                if (!ok) return false;
+                addBalance(amount);
+                return true;
+
+            case 'K':
+                if (!checkpoint()) {
+                    cout << "Checkpoint failed (is --data-dir set?)" << endl;
+                }
+                return true;
+
+            case 'H': {
+                double offset = 0.0, limit = 0.0;
+                p = nextToken(p, first);
+                if (*skipSpaces(p)) {
+                    p = nextNumber(p, offset, ok);
+                }
+                if (*skipSpaces(p)) {
+                    p = nextNumber(p, limit, ok);
+                }
+                if (!ok || first.empty() || offset < 0 || limit < 0) return false;
+                displayBidHistory(first, (size_t)offset, (size_t)limit);
+                return true;
+            }
+
+            case 'M':
+                cout << renderMetrics();
+                return true;
+
+            case 'T': {
+                double at = 0.0, epochMillis = -1.0;
+                p = nextNumber(p, at, ok);
+                if (*skipSpaces(p)) {
+                    p = nextNumber(p, epochMillis, ok);
+                }
+                if (!ok || at < 0) return false;
+                advanceReplay(at, epochMillis);
+                return true;
+            }
+
+            case 'V': {
+                BrowseOptions options;
+                double offset = 0.0, limit = 0.0;
+                p = nextNumber(p, options.minPrice, ok);
+                p = nextNumber(p, options.maxPrice, ok);
+                if (*skipSpaces(p)) {
+                    p = nextNumber(p, offset, ok);
+                }
+                if (*skipSpaces(p)) {
+                    p = nextNumber(p, limit, ok);
+                }
+                if (!ok || offset < 0 || limit < 0) return false;
+                options.offset = (size_t)offset;
+                options.limit = (size_t)limit;
+                displayBrowse(options);
+                return true;
+            }
+
+            case 'S':
+                first.assign(skipSpaces(p));
+                if (first.empty()) return false;
+                searchAuctions(first);
+                return true;
+
+            default:
+                return false;
+        }
+    }
+};
+
+
+
+#ifdef __linux__
+// Binary request/response front-end for AuctionSystem over TCP.
+//
+// Every frame is a little-endian u32 length (of what follows) and then
+//   request:  u8 op, u32 request id, payload
+//   response: u8 op, u32 request id, u8 status, payload
+// Strings are a u32 length and the bytes, as in the WAL. Clients may pipeline
+// any number of requests; each connection's requests are applied in order
+// and its responses are written back in one send per readiness event.
+//
+// A subscribed connection is also sent the event feed (see publishEvents)
+// once per EVENT_TICK.
+//
+// One thread runs the epoll loop and applies requests directly. A bid takes
+// well under a microsecond, so the fixed costs that matter are syscalls,
+// which pipelining and batched writes amortize.
+class AuctionServer {
+public:
+    enum Op : uint8_t {
+        Register = 1,      // str username, str email, f64 balance -> u32 user
+        Login = 2,         // str username -> u32 user
+        Logout = 3,        // -
+        CreateAuction = 4, // str name, str description, f64 start, f64 reserve, i32 minutes[, u8 AuctionFormat, f64 increment]
+                           //   -> u32 item, str display id
+        PlaceBid = 5,      // u32 item, f64 amount -> u8 BidStatus, f64 amount, f64 reference
+        PlaceProxyBid = 6, // u32 item, f64 maximum -> as PlaceBid
+        Search = 7,        // str query, u8 active only, u32 limit -> u32 count, count x u32 item
+        Quote = 8,         // u32 item -> f64 price, u32 bids, u32 leader, u8 active, i32 seconds left
+        AddBalance = 9,    // f64 amount -> f64 balance
+        EndAuction = 10,   // u32 item -> u8 SettlementStatus, u32 winner, f64 price
+        Subscribe = 11,    // - ; the connection then receives Event frames
+        Event = 12,        // pushed with request id 0: u64 sequence, u8 AuctionEventKind, u32 item, u32 user, f64 price, u32 bids
+        Browse = 13,       // f64 min price, f64 max price, u8 BrowseOrder, u32 offset, u32 limit -> u32 count, count x u32 item
+        Replicate = 14,    // - -> u64 snapshot size; the connection then receives ReplicaSnapshot and ReplicaLog frames
+        ReplicaSnapshot = 15, // pushed with request id 0: the next piece of the leader's snapshot file
+        ReplicaLog = 16    // pushed with request id 0: the next bytes of the leader's log records, as framed in the WAL file
+    };
+    
+    enum Status : uint8_t {
+        Ok = 0,
+        BadRequest = 1,
+        NotLoggedIn = 2,
+        NotFound = 3,
+        Conflict = 4, // username taken, auction already ended, no log to replicate
+        ReadOnly = 5  // a follower; changes go to the leader
+    };
+    
+    static constexpr uint32_t MAX_FRAME = 1 << 20;
+    
+private:
+    static constexpr size_t READ_CHUNK = 64 << 10;
+    static constexpr size_t MAX_PENDING_OUTPUT = 8 << 20; // stop reading a client that does not drain
+    static constexpr milliseconds EVENT_TICK{100};
+    static constexpr size_t REPLICA_CHUNK = 256 << 10; // largest snapshot or log piece per frame
+    static constexpr size_t MAX_REPLICA_BACKLOG = 64 << 20; // a follower further behind is dropped
+    
+    // Text fields must read back the same from a batch line (see record):
+    // usernames and emails are single words, names and descriptions one
+    // line, and a name cannot hold the '|' that ends it or start with a space
+    static bool isWord(const string& text) {
+        return !text.empty() && all_of(text.begin(), text.end(), [](char c) { return (unsigned char)c > ' ' && c != 0x7f; });
+    }
+    
+    static bool isLine(const string& text) {
+        return all_of(text.begin(), text.end(), [](char c) { return (unsigned char)c >= ' ' && c != 0x7f; });
+    }
+    
+    static bool isItemName(const string& name) {
+        return isLine(name) && name.find('|') == string::npos && (name.empty() || name[0] != ' ');
+    }
+    
+    // The optional format fields of CreateAuction; English when left out
+    static bool readRules(BinaryReader& request, AuctionRules& rules) {
+        rules = AuctionRules();
+        if (request.atEnd()) {
+            return true;
+        }
+        rules.format = (AuctionFormat)request.get<uint8_t>();
+        rules.increment = request.get<double>();
+        return request.ok() && rules.format <= AuctionFormat::Dutch &&
+               (rules.format != AuctionFormat::MinimumIncrement || rules.increment > 0.0);
+    }
+    
+    struct Connection {
+        int fd;
+        string in;
+        size_t inOffset = 0;
+        string out;
+        size_t outOffset = 0;
+        bool wantWrite = false;
+        Session session;
+        bool subscribed = false;
+        uint64_t eventCursor = 0;
+        bool follower = false; // sent the log; see Replicate
+        bool leader = false;   // on a follower, the link its log arrives on
+    };
+    
+    AuctionSystem& system;
+    int listenFd = -1;
+    int epollFd = -1;
+    int wakeFd = -1;
+    atomic<bool> stopping{false};
+    unordered_map<int, unique_ptr<Connection>> connections;
+    BinaryWriter response;
+    vector<BidCommand> pendingBids;
+    CommandRecorder* recorder = nullptr;
+    // Leader side of replication: batches the log's flusher made durable,
+    // waiting for the loop to pass them on (see shipLog)
+    bool shipping = false;
+    mutex shippedLock;
+    string shipped;
+    // Follower side: log bytes from the leader not yet applied
+    string replicated;
+    
+    void watch(Connection& connection) {
+        epoll_event event{};
+        event.events = EPOLLIN | EPOLLRDHUP | (connection.wantWrite ? (uint32_t)EPOLLOUT : 0u);
+        event.data.fd = connection.fd;
+        epoll_ctl(epollFd, EPOLL_CTL_MOD, connection.fd, &event);
+    }
+    
+    void acceptClients() {
+        while (true) {
+            int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) {
+                return; // EAGAIN, or a client that gave up before we got to it
+            }
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+            epoll_event event{};
+            event.events = EPOLLIN | EPOLLRDHUP;
+            event.data.fd = fd;
+            if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) != 0) {
+                ::close(fd);
+                continue;
+            }
+            auto connection = make_unique<Connection>();
+            connection->fd = fd;
+            connections.emplace(fd, std::move(connection));
+        }
+    }
+    
+    void disconnect(int fd) {
+        auto it = connections.find(fd);
+        if (it != connections.end() && it->second->subscribed) {
+            system.unsubscribeEvents();
+        }
+        if (it != connections.end() && it->second->leader) {
+            cerr << "Lost the leader; serving the state replicated so far" << endl;
+        }
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+        ::close(fd);
+        connections.erase(fd);
+    }
+    
+    // Returns false once the peer has closed or the connection failed
+    bool readFrom(Connection& connection) {
+        char buffer[READ_CHUNK];
+        while (connection.out.size() - connection.outOffset < MAX_PENDING_OUTPUT) {
+            ssize_t n = ::read(connection.fd, buffer, sizeof buffer);
+            if (n == 0) {
+                return false;
+            }
+            if (n < 0) {
+                return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+            }
+            connection.in.append(buffer, (size_t)n);
+            if (!processFrames(connection)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    
+    bool writeTo(Connection& connection) {
+        while (connection.outOffset < connection.out.size()) {
+            ssize_t n = ::send(connection.fd, connection.out.data() + connection.outOffset,
+                               connection.out.size() - connection.outOffset, MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                return false;
+            }
+            connection.outOffset += (size_t)n;
+        }
+        if (connection.outOffset == connection.out.size()) {
+            connection.out.clear();
+            connection.outOffset = 0;
+        }
+        bool wantWrite = !connection.out.empty();
+        if (wantWrite != connection.wantWrite) {
+            connection.wantWrite = wantWrite;
+            watch(connection);
+        }
+        return true;
+    }
+    
+    // Handles every complete frame buffered so far. Returns false on a framing error.
+    bool processFrames(Connection& connection) {
+        while (connection.in.size() - connection.inOffset >= 4) {
+            uint32_t length;
+            memcpy(&length, connection.in.data() + connection.inOffset, 4);
+            if (length < 5 || length > MAX_FRAME) {
+                return false;
+            }
+            if (connection.in.size() - connection.inOffset - 4 < length) {
+                break;
+            }
+            const char* frame = connection.in.data() + connection.inOffset + 4;
+            if (connection.leader) {
+                if (!applyFromLeader(frame, length)) {
+                    return false;
+                }
+                connection.inOffset += 4 + length;
+                continue;
+            }
+            if (recorder) {
+                record(connection, (uint8_t)frame[0], frame + 1, length - 1);
+            }
+            if (!queueBid(connection, (uint8_t)frame[0], frame + 1, length - 1)) {
+                flushBids(connection);
+                handle(connection, (uint8_t)frame[0], frame + 1, length - 1);
+            }
+            connection.inOffset += 4 + length;
+        }
+        flushBids(connection);
+        // Compact once the consumed prefix dominates the buffer
+        if (connection.inOffset > 0 && connection.inOffset * 2 >= connection.in.size()) {
+            connection.in.erase(0, connection.inOffset);
+            connection.inOffset = 0;
+        }
+        return true;
+    }
+    
+    // Writes the batch command equivalent to a request. Logins only change
+    // whose session later commands run in; reads without a batch form (quotes,
+    // subscriptions) are left out.
+    void record(Connection& connection, uint8_t op, const char* body, size_t size) {
+        BinaryReader request(body, size);
+        request.get<uint32_t>();
+        ostringstream command;
+        command << setprecision(17);
+        switch (op) {
+            case Register: {
+                string username = request.getString();
+                string email = request.getString();
+                double balance = request.get<double>();
+                if (!isWord(username) || !isWord(email)) {
+                    return;
+                }
+                command << "R " << username << ' ' << email << ' ' << balance;
+                break;
+            }
+            case CreateAuction: {
+                string name = request.getString();
+                string description = request.getString();
+                double startingPrice = request.get<double>();
+                double reservePrice = request.get<double>();
+                int32_t minutes = request.get<int32_t>();
+                AuctionRules rules;
+                if (!readRules(request, rules) || !isItemName(name) || !isLine(description) ||
+                    minutes <= 0 || minutes > MAX_AUCTION_MINUTES) {
+                    return;
+                }
+                command << "C " << startingPrice << ' ' << reservePrice << ' ' << minutes << ' ' << name << '|' << description;
+                // Spelled out whenever the description could pass for a format
+                if (rules.format != AuctionFormat::English || description.find('|') != string::npos) {
+                    command << '|' << formatRules(rules);
+                }
+                break;
+            }
+            case PlaceBid:
+            case PlaceProxyBid: {
+                ItemId itemId = request.get<ItemId>();
+                double amount = request.get<double>();
+                if (itemId >= system.auctionCount()) {
+                    return;
+                }
+                command << (op == PlaceBid ? "B " : "P ") << system.itemName(itemId) << ' ' << amount;
+                break;
+            }
+            case Search:
+                command << "S " << request.getString();
+                break;
+            case AddBalance:
+                command << "A " << request.get<double>();
+                break;
+            case EndAuction: {
+                ItemId itemId = request.get<ItemId>();
+                if (itemId >= system.auctionCount()) {
+                    return;
+                }
+                command << "E " << system.itemName(itemId);
+                break;
+            }
+            case Browse: {
+                double minPrice = request.get<double>();
+                double maxPrice = request.get<double>();
+                request.get<uint8_t>();
+                uint32_t offset = request.get<uint32_t>();
+                uint32_t limit = request.get<uint32_t>();
+                command << "V " << minPrice << ' ' << maxPrice << ' ' << offset << ' ' << limit;
+                break;
+            }
+            default:
+                return;
+        }
+        string line = command.str();
+        if (!request.ok() || line.find_first_of("\r\n") != string::npos) {
+            return;
+        }
+        const Session& session = connection.session;
+        recorder->record(session.userId, session.loggedIn() ? system.loginName(session.userId) : string(), line);
+    }
+    
+    // Consecutive plain bids from one read are applied as a single burst
+    // (see AuctionSystem::submitBids); anything else goes through handle
+    bool queueBid(Connection& connection, uint8_t op, const char* body, size_t size) {
+        if (op != PlaceBid || system.isReplica()) {
+            return false;
+        }
+        BinaryReader request(body, size);
+        uint32_t requestId = request.get<uint32_t>();
+        ItemId itemId = request.get<ItemId>();
+        double amount = request.get<double>();
+        if (!request.ok()) {
+            return false;
+        }
+        pendingBids.push_back(BidCommand{connection.session, itemId, amount, requestId, nullptr});
+        return true;
+    }
+    
+    void flushBids(Connection& connection) {
+        if (pendingBids.empty()) {
+            return;
+        }
+        vector<BidResult> results = system.submitBids(pendingBids);
+        for (size_t i = 0; i < results.size(); i++) {
+            response.clear();
+            response.put((uint8_t)results[i].status);
+            response.put(results[i].amount);
+            response.put(results[i].reference);
+            reply(connection, PlaceBid, (uint32_t)pendingBids[i].tag, Ok);
+        }
+        pendingBids.clear();
+    }
+    
+    void handle(Connection& connection, uint8_t op, const char* body, size_t size) {
+        BinaryReader request(body, size);
+        uint32_t requestId = request.get<uint32_t>();
+        Status status = Ok;
+        response.clear();
+        
+        // A follower only changes through its leader's log
+        bool changes = op == Register || op == CreateAuction || op == PlaceBid || op == PlaceProxyBid ||
+                       op == AddBalance || op == EndAuction;
+        if (changes && system.isReplica()) {
+            reply(connection, op, requestId, ReadOnly);
+            return;
+        }
+        
+        switch (op) {
+            case Register: {
+                string username = request.getString();
+                string email = request.getString();
+                double balance = request.get<double>();
+                if (!request.ok() || !isWord(username) || !isWord(email)) {
+                    status = BadRequest;
+                    break;
+                }
+                UserId userId = system.addUser(username, email, balance);
+                if (userId == NO_ID) {
+                    status = Conflict;
+                }
+                response.put(userId);
+                break;
+            }
+            
+            case Login: {
+                string username = request.getString();
+                if (!request.ok()) {
+                    status = BadRequest;
+                    break;
+                }
+                connection.session = system.openSession(username);
+                if (!connection.session.loggedIn()) {
+                    status = NotFound;
+                }
+                response.put(connection.session.userId);
+                break;
+            }
+            
+            case Logout:
+                connection.session = Session();
+                break;
+                
+            case CreateAuction: {
+                string name = request.getString();
+                string description = request.getString();
+                double startingPrice = request.get<double>();
+                double reservePrice = request.get<double>();
+                int32_t minutes = request.get<int32_t>();
+                AuctionRules rules;
+                if (!request.ok() || !readRules(request, rules) || !isItemName(name) || !isLine(description) ||
+                    minutes <= 0 || minutes > MAX_AUCTION_MINUTES) {
+                    status = BadRequest;
+                    break;
+                }
+                ItemId itemId = system.addAuction(connection.session, name, description, startingPrice, reservePrice, minutes, rules);
+                if (itemId == NO_ID) {
+                    status = NotLoggedIn;
+                    break;
+                }
+                response.put(itemId);
+                response.putString(system.itemName(itemId));
+                break;
+            }
+            
+            case PlaceBid:
+            case PlaceProxyBid: {
+                ItemId itemId = request.get<ItemId>();
+                double amount = request.get<double>();
+                if (!request.ok()) {
+                    status = BadRequest;
+                    break;
+                }
+                BidResult result = op == PlaceBid ? system.submitBid(connection.session, itemId, amount)
+                                                  : system.submitProxyBid(connection.session, itemId, amount);
+                response.put((uint8_t)result.status);
+                response.put(result.amount);
+                response.put(result.reference);
+                break;
+            }
+            
+            case Search: {
+                string query = request.getString();
+                SearchOptions options;
+                options.activeOnly = request.get<uint8_t>() != 0;
+                options.limit = request.get<uint32_t>();
+                if (!request.ok()) {
+                    status = BadRequest;
+                    break;
+                }
+                vector<ItemId> matches = system.findAuctions(query, options);
+                response.put((uint32_t)matches.size());
+                for (ItemId itemId : matches) {
+                    response.put(itemId);
+                }
+                break;
+            }
+            
+            case Quote: {
+                ItemId itemId = request.get<ItemId>();
+                AuctionQuote quote;
+                if (!request.ok()) {
+                    status = BadRequest;
+                } else if (!system.quoteAuction(itemId, quote)) {
+                    status = NotFound;
+                } else {
+                    response.put(quote.price);
+                    response.put(quote.bidCount);
+                    response.put(quote.leader);
+                    response.put((uint8_t)quote.active);
+                    response.put((int32_t)quote.remainingSeconds);
+                }
+                break;
+            }
+            
+            case AddBalance: {
+                double amount = request.get<double>();
+                if (!request.ok()) {
+                    status = BadRequest;
+                    break;
+                }
+                double balance = system.addBalance(connection.session, amount);
+                if (balance < 0) {
+                    status = NotLoggedIn;
+                }
+                response.put(balance);
+                break;
+            }
+            
+            case EndAuction: {
+                ItemId itemId = request.get<ItemId>();
+                Settlement settlement{};
+                if (!request.ok()) {
+                    status = BadRequest;
+                } else if (!system.closeAuction(itemId, settlement)) {
+                    status = itemId < system.auctionCount() ? Conflict : NotFound;
+                } else {
+                    response.put((uint8_t)settlement.status);
+                    response.put(settlement.winner);
+                    response.put(settlement.price);
+                }
+                break;
+            }
+            
+            case Browse: {
+                BrowseOptions options;
+                options.minPrice = request.get<double>();
+                options.maxPrice = request.get<double>();
+                uint8_t order = request.get<uint8_t>();
+                options.offset = request.get<uint32_t>();
+                options.limit = request.get<uint32_t>();
+                if (!request.ok() || order > (uint8_t)BrowseOrder::PriceHighest) {
+                    status = BadRequest;
                     break;
-                    
-                case 13:
-                    cout << "Enter item ID: ";
-                    getline(cin, itemId);
-                    displayTopBidders(itemId);
+                }
+                options.order = (BrowseOrder)order;
+                vector<ItemId> page = system.browseAuctions(options);
+                response.put((uint32_t)page.size());
+                for (ItemId itemId : page) {
+                    response.put(itemId);
+                }
+                break;
+            }
+            
+            case Subscribe:
+                if (!connection.subscribed) {
+                    connection.subscribed = true;
+                    connection.eventCursor = system.subscribeEvents();
+                }
+                break;
+                
+            case Replicate: {
+                // Records logged before the snapshot go only to the followers
+                // that were already here; the new one gets everything after it
+                string snapshot;
+                if (connection.follower || !startShipping() || !system.replicaSnapshot(snapshot)) {
+                    status = Conflict;
                     break;
-                    
-                case 0:
-                    cout << "Thank you for using Advanced Auction System!" << endl;
-                    return;
-                    
-                default:
-                    cout << "Invalid choice! Please try again." << endl;
+                }
+                shipLog();
+                response.put((uint64_t)snapshot.size());
+                reply(connection, op, requestId, status);
+                for (size_t offset = 0; offset < snapshot.size(); offset += REPLICA_CHUNK) {
+                    push(connection, ReplicaSnapshot, snapshot.data() + offset, min(REPLICA_CHUNK, snapshot.size() - offset));
+                }
+                connection.follower = true;
+                cerr << "Follower joined; sent a " << snapshot.size() << " byte snapshot" << endl;
+                return;
+            }
+                
+            default:
+                status = BadRequest;
+                break;
+        }
+        
+        if (status == BadRequest) {
+            response.clear();
+        }
+        reply(connection, op, requestId, status);
+    }
+    
+    // Frames the payload in `response`
+    void reply(Connection& connection, uint8_t op, uint32_t requestId, Status status) {
+        uint32_t length = (uint32_t)(1 + 4 + 1 + response.str().size());
+        connection.out.append(reinterpret_cast<const char*>(&length), 4);
+        connection.out.push_back((char)op);
+        connection.out.append(reinterpret_cast<const char*>(&requestId), 4);
+        connection.out.push_back((char)status);
+        connection.out.append(response.str());
+    }
+    
+    // Frames raw bytes as a push, without copying them into `response`
+    void push(Connection& connection, uint8_t op, const char* data, size_t size) {
+        uint32_t length = (uint32_t)(1 + 4 + 1 + size);
+        uint32_t requestId = 0;
+        connection.out.append(reinterpret_cast<const char*>(&length), 4);
+        connection.out.push_back((char)op);
+        connection.out.append(reinterpret_cast<const char*>(&requestId), 4);
+        connection.out.push_back((char)Ok);
+        connection.out.append(data, size);
+    }
+    
+    // Has the log hand its durable batches to this server. Shipping them
+    // once per group commit keeps replication off the bid path: a bid is
+    // answered as soon as it is applied, and followers trail by about one
+    // commit interval.
+    bool startShipping() {
+        if (!shipping) {
+            shipping = system.setLogShipper([this](const string& batch) {
+                lock_guard<mutex> guard(shippedLock);
+                shipped.append(batch);
+                uint64_t one = 1;
+                ssize_t ignored = ::write(wakeFd, &one, sizeof one);
+                (void)ignored;
+            });
+        }
+        return shipping;
+    }
+    
+    // Passes the batches shipped since the last call on to every follower
+    void shipLog() {
+        string batch;
+        {
+            lock_guard<mutex> guard(shippedLock);
+            batch.swap(shipped);
+        }
+        if (batch.empty()) {
+            return;
+        }
+        vector<int> failed;
+        for (auto& entry : connections) {
+            Connection& connection = *entry.second;
+            if (!connection.follower) {
+                continue;
+            }
+            for (size_t offset = 0; offset < batch.size(); offset += REPLICA_CHUNK) {
+                push(connection, ReplicaLog, batch.data() + offset, min(REPLICA_CHUNK, batch.size() - offset));
+            }
+            // Records cannot be skipped, so a follower this far behind has to rejoin
+            if (connection.out.size() - connection.outOffset > MAX_REPLICA_BACKLOG || !writeTo(connection)) {
+                failed.push_back(entry.first);
+            }
+        }
+        for (int fd : failed) {
+            disconnect(fd);
+        }
+    }
+    
+    // One frame from the leader: op, request id, status, then log bytes
+    bool applyFromLeader(const char* frame, uint32_t length) {
+        if (length < 6 || (uint8_t)frame[0] != ReplicaLog) {
+            cerr << "Unexpected frame from the leader" << endl;
+            return false;
+        }
+        replicated.append(frame + 6, length - 6);
+        if (!system.applyReplicated(replicated)) {
+            cerr << "Corrupt log record from the leader" << endl;
+            return false;
+        }
+        return true;
+    }
+    
+    // Blocking helpers for the handshake in follow()
+    static bool sendAll(int fd, const string& data) {
+        size_t sent = 0;
+        while (sent < data.size()) {
+            ssize_t n = ::send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            sent += (size_t)n;
+        }
+        return true;
+    }
+    
+    // Moves the next frame (without its length) from `buffer` to `frame`,
+    // reading from fd until it is complete
+    static bool receiveFrame(int fd, string& buffer, string& frame) {
+        char chunk[READ_CHUNK];
+        while (true) {
+            if (buffer.size() >= 4) {
+                uint32_t length;
+                memcpy(&length, buffer.data(), 4);
+                if (length < 6 || length > MAX_FRAME) {
+                    return false;
+                }
+                if (buffer.size() - 4 >= length) {
+                    frame.assign(buffer, 4, length);
+                    buffer.erase(0, 4 + length);
+                    return true;
+                }
+            }
+            ssize_t n = ::recv(fd, chunk, sizeof chunk, 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            buffer.append(chunk, (size_t)n);
+        }
+    }
+    
+    // Publishes the tick's events and queues them to every subscriber
+    void pushEvents() {
+        system.publishEvents();
+        vector<int> failed;
+        vector<AuctionEvent> events;
+        for (auto& entry : connections) {
+            Connection& connection = *entry.second;
+            if (!connection.subscribed || connection.out.size() - connection.outOffset >= MAX_PENDING_OUTPUT) {
+                continue; // a stalled subscriber sees the gap in sequence numbers later
+            }
+            events.clear();
+            system.readEvents(connection.eventCursor, events);
+            for (const AuctionEvent& event : events) {
+                response.clear();
+                response.put(event.sequence);
+                response.put((uint8_t)event.kind);
+                response.put(event.item);
+                response.put(event.user);
+                response.put(event.price);
+                response.put(event.bidCount);
+                reply(connection, Event, 0, Ok);
+            }
+            if (!events.empty() && !writeTo(connection)) {
+                failed.push_back(entry.first);
+            }
+        }
+        for (int fd : failed) {
+            disconnect(fd);
+        }
+    }
+    
+public:
+    explicit AuctionServer(AuctionSystem& sys) : system(sys) {}
+    
+    // Records the requests served from now on (see CommandRecorder)
+    void setRecorder(CommandRecorder* commandRecorder) {
+        recorder = commandRecorder;
+    }
+    
+    AuctionServer(const AuctionServer&) = delete;
+    AuctionServer& operator=(const AuctionServer&) = delete;
+    
+    ~AuctionServer() {
+        for (auto& entry : connections) {
+            ::close(entry.first);
+        }
+        if (shipping) {
+            system.setLogShipper(nullptr);
+        }
+        if (listenFd >= 0) ::close(listenFd);
+        if (wakeFd >= 0) ::close(wakeFd);
+        if (epollFd >= 0) ::close(epollFd);
+    }
+    
+    bool listen(uint16_t port) {
+        listenFd = socket(AF_INET6, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (listenFd < 0) {
+            cerr << "Cannot create socket: " << strerror(errno) << endl;
+            return false;
+        }
+        int one = 1;
+        int zero = 0;
+        setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+        setsockopt(listenFd, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof zero);
+        sockaddr_in6 address{};
+        address.sin6_family = AF_INET6;
+        address.sin6_addr = in6addr_any;
+        address.sin6_port = htons(port);
+        if (::bind(listenFd, (sockaddr*)&address, sizeof address) != 0 || ::listen(listenFd, SOMAXCONN) != 0) {
+            cerr << "Cannot listen on port " << port << ": " << strerror(errno) << endl;
+            return false;
+        }
+        
+        epollFd = epoll_create1(EPOLL_CLOEXEC);
+        wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (epollFd < 0 || wakeFd < 0) {
+            cerr << "Cannot set up epoll: " << strerror(errno) << endl;
+            return false;
+        }
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.fd = listenFd;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &event);
+        event.data.fd = wakeFd;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &event);
+        return true;
+    }
+    
+    // Makes this server a follower of the leader at host:leaderPort: loads
+    // the leader's snapshot, blocking until it is in, after which run()
+    // applies the leader's log as it arrives and only serves reads. Call
+    // after listen() and before run(), on an empty in-memory system.
+    bool follow(const string& host, uint16_t leaderPort) {
+        addrinfo hints{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* found = nullptr;
+        if (getaddrinfo(host.c_str(), to_string(leaderPort).c_str(), &hints, &found) != 0) {
+            cerr << "Cannot resolve leader " << host << endl;
+            return false;
+        }
+        int fd = -1;
+        for (addrinfo* candidate = found; candidate != nullptr && fd < 0; candidate = candidate->ai_next) {
+            fd = socket(candidate->ai_family, candidate->ai_socktype | SOCK_CLOEXEC, candidate->ai_protocol);
+            if (fd >= 0 && ::connect(fd, candidate->ai_addr, candidate->ai_addrlen) != 0) {
+                ::close(fd);
+                fd = -1;
+            }
+        }
+        freeaddrinfo(found);
+        if (fd < 0) {
+            cerr << "Cannot connect to leader " << host << ":" << leaderPort << endl;
+            return false;
+        }
+        
+        auto link = make_unique<Connection>();
+        link->fd = fd;
+        link->leader = true;
+        BinaryWriter request;
+        request.put((uint32_t)5);
+        request.put((uint8_t)Replicate);
+        request.put((uint32_t)1);
+        string frame;
+        if (!sendAll(fd, request.str()) || !receiveFrame(fd, link->in, frame) ||
+            (uint8_t)frame[0] != Replicate || (Status)frame[5] != Ok || frame.size() < 14) {
+            cerr << "Leader " << host << ":" << leaderPort << " refused to replicate" << endl;
+            ::close(fd);
+            return false;
+        }
+        uint64_t snapshotSize;
+        memcpy(&snapshotSize, frame.data() + 6, 8);
+        
+        // The snapshot is mapped like a local one, so it goes through a file
+        char path[] = "/tmp/auction-replica-XXXXXX";
+        int file = mkstemp(path);
+        if (file < 0) {
+            cerr << "Cannot create a file for the leader's snapshot: " << strerror(errno) << endl;
+            ::close(fd);
+            return false;
+        }
+        uint64_t received = 0;
+        bool ok = true;
+        while (ok && received < snapshotSize) {
+            ok = receiveFrame(fd, link->in, frame) && (uint8_t)frame[0] == ReplicaSnapshot &&
+                 ::write(file, frame.data() + 6, frame.size() - 6) == (ssize_t)(frame.size() - 6);
+            received += frame.size() - 6;
+        }
+        ::close(file);
+        ok = ok && received == snapshotSize && system.startReplica(path);
+        ::unlink(path);
+        if (!ok) {
+            cerr << "Cannot load the snapshot from leader " << host << ":" << leaderPort << endl;
+            ::close(fd);
+            return false;
+        }
+        
+        ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+        epoll_event event{};
+        event.events = EPOLLIN | EPOLLRDHUP;
+        event.data.fd = fd;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event);
+        Connection& connection = *connections.emplace(fd, move(link)).first->second;
+        // Log frames that came in behind the snapshot
+        if (!processFrames(connection)) {
+            disconnect(fd);
+            return false;
+        }
+        cerr << "Following " << host << ":" << leaderPort << " from a " << snapshotSize << " byte snapshot" << endl;
+        return true;
+    }
+    
+    // The bound port, useful after listen(0)
+    uint16_t port() const {
+        sockaddr_in6 address{};
+        socklen_t size = sizeof address;
+        getsockname(listenFd, (sockaddr*)&address, &size);
+        return ntohs(address.sin6_port);
+    }
+    
+    // Serves clients until stop() is called
+    void run() {
+        epoll_event events[256];
+        auto lastTick = steady_clock::now();
+        while (!stopping.load(memory_order_acquire)) {
+            // The timeout lets expired auctions settle while clients are idle
+            int ready = epoll_wait(epollFd, events, 256, (int)EVENT_TICK.count());
+            for (int i = 0; i < ready; i++) {
+                int fd = events[i].data.fd;
+                if (fd == listenFd) {
+                    acceptClients();
+                    continue;
+                }
+                if (fd == wakeFd) {
+                    uint64_t value;
+                    ssize_t ignored = ::read(wakeFd, &value, sizeof value);
+                    (void)ignored;
+                    continue;
+                }
+                auto it = connections.find(fd);
+                if (it == connections.end()) {
+                    continue;
+                }
+                Connection& connection = *it->second;
+                bool alive = !(events[i].events & EPOLLERR);
+                if (alive && (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP))) {
+                    alive = readFrom(connection);
+                }
+                // Answer whatever was handled even if the peer half-closed
+                if (!writeTo(connection) || !alive) {
+                    disconnect(fd);
+                }
+            }
+            if (shipping) {
+                shipLog();
+            }
+            auto now = steady_clock::now();
+            system.settleExpiredAuctions(Clock::now());
+            if (now - lastTick >= EVENT_TICK) {
+                lastTick = now;
+                pushEvents();
+                if (recorder) {
+                    recorder->flush();
+                }
+            }
+        }
+    }
+    
+    // Safe to call from another thread or a signal handler
+    void stop() {
+        stopping.store(true, memory_order_release);
+        uint64_t one = 1;
+        ssize_t ignored = ::write(wakeFd, &one, sizeof one);
+        (void)ignored;
+    }
+};
+#endif
+
+static string formatNanos(uint64_t nanos) {
+    ostringstream text;
+    text << fixed << setprecision(nanos < 10000 ? 0 : 1);
+    if (nanos < 10000) {
+        text << nanos << "ns";
+    } else if (nanos < 10000000) {
+        text << nanos / 1000.0 << "us";
+    } else {
+        text << nanos / 1000000.0 << "ms";
+    }
+    return text.str();
+}
+
+// Draws ranks in [0, n) with probability proportional to 1 / (rank + 1)^s,
+// the popularity curve of real catalogs: a few items draw most of the bids
+class ZipfSampler {
+private:
+    vector<double> cdf;
+    uniform_real_distribution<double> unit{0.0, 1.0};
+    
+public:
+    ZipfSampler(size_t n, double s) : cdf(max<size_t>(1, n)) {
+        double sum = 0.0;
+        for (size_t i = 0; i < cdf.size(); i++) {
+            sum += pow((double)(i + 1), -s);
+            cdf[i] = sum;
+        }
+        for (double& value : cdf) {
+            value /= sum;
+        }
+    }
+    
+    template <typename Rng>
+    size_t operator()(Rng& rng) {
+        size_t rank = (size_t)(lower_bound(cdf.begin(), cdf.end(), unit(rng)) - cdf.begin());
+        return min(rank, cdf.size() - 1);
+    }
+};
+
+struct BenchOptions {
+    size_t bids = 1000000;
+    size_t users = 10000;
+    size_t auctions = 1000;
+    size_t hotAuctions = 4; // the "hot" workload sends hotShare of its bids here
+    double hotShare = 0.9;
+    size_t shards = 4;
+    size_t queries = 10000;
+    uint64_t seed = 42;
+    double zipf = 1.0; // skew of the zipf workload's item popularity
+    double rate = 0.0; // --generate only: bids per second, 0 for no T lines
+};
+
+// Synthetic workloads for the bidding hot path (`index --bench`). Every
+// scenario reports throughput, latency percentiles and the process's peak
+// RSS so far. Command output is discarded while a scenario runs.
+class Benchmark {
+private:
+    struct BidOp {
+        uint32_t user;
+        ItemId item;
+        double amount;
+    };
+
+    BenchOptions options;
+    ostream& out;
+    mt19937_64 rng;
+
+    static long peakRssKb() {
+#ifdef __unix__
+        rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_maxrss;
+#else
+        return 0;
+#endif
+    }
+
+    void report(const string& name, size_t ops, double seconds, const LatencyHistogram* latency) {
+        out << left << setw(26) << name << right << setw(10) << ops << " ops "
+            << fixed << setprecision(2) << setw(9) << (seconds > 0 ? ops / seconds / 1e6 : 0.0) << " Mops/s";
+        if (latency != nullptr && latency->count() > 0) {
+            out << "  p50 " << setw(7) << formatNanos(latency->percentile(0.50))
+                << "  p99 " << setw(7) << formatNanos(latency->percentile(0.99))
+                << "  p999 " << setw(7) << formatNanos(latency->percentile(0.999));
+        }
+        out << "  peak RSS " << peakRssKb() / 1024 << " MB" << endl;
+    }
+
+    // Times fn(i) for i in [0, ops) individually and as a whole
+    template <typename Fn>
+    void measure(const string& name, size_t ops, Fn fn) {
+        LatencyHistogram latency;
+        auto start = steady_clock::now();
+        auto last = start;
+        for (size_t i = 0; i < ops; i++) {
+            fn(i);
+            auto now = steady_clock::now();
+            latency.record((uint64_t)duration_cast<nanoseconds>(now - last).count());
+            last = now;
+        }
+        report(name, ops, duration<double>(last - start).count(), &latency);
+    }
+
+    // Bids whose amounts mostly climb per auction, with about one in ten
+    // arriving below the current price so the rejection path is exercised too.
+    // With `zipf` the auction is drawn from it instead of the hot/uniform mix.
+    vector<BidOp> makeBids(size_t count, size_t auctionCount, size_t hotCount, double hotShare, ZipfSampler* zipf = nullptr) {
+        vector<BidOp> ops;
+        ops.reserve(count);
+        vector<double> price(auctionCount, 1.0);
+        uniform_real_distribution<double> unit(0.0, 1.0);
+        for (size_t i = 0; i < count; i++) {
+            size_t auction = zipf ? (*zipf)(rng)
+                           : (hotCount > 0 && unit(rng) < hotShare) ? rng() % hotCount : rng() % auctionCount;
+            double amount;
+            if (rng() % 10 == 0) {
+                amount = price[auction] * 0.5;
+            } else {
+                price[auction] += 1.0 + (double)(rng() % 5);
+                amount = price[auction];
+            }
+            ops.push_back(BidOp{(uint32_t)(1 + rng() % (options.users - 1)), (ItemId)auction, amount});
+        }
+        return ops;
+    }
+
+    // Registers options.users users and options.auctions auctions owned by the first user
+    void populate(AuctionSystem& system, vector<Session>& sessions) {
+        sessions.clear();
+        for (size_t u = 0; u < options.users; u++) {
+            UserId id = system.addUser("bench" + to_string(u), "bench@example.com", 1e15);
+            Session session;
+            session.userId = id;
+            sessions.push_back(session);
+        }
+        static const char* words[] = {"vintage", "camera", "lamp", "watch", "guitar", "bike", "rare", "coin", "poster", "vinyl"};
+        for (size_t a = 0; a < options.auctions; a++) {
+            string name = string(words[a % 10]) + " " + words[(a / 10) % 10];
+            system.addAuction(sessions[0], name, "lot " + to_string(a) + " " + words[(a * 7) % 10], 0.5, 10.0, 600);
+        }
+    }
+
+    void benchAuctionPlaceBid() {
+        AuctionHot hot(0.5, 1.0, 0, steady_clock::now() + minutes(600));
+        Auction auction(hot);
+        size_t bidders = max<size_t>(1, options.users);
+        measure("Auction::placeBid", options.bids, [&](size_t i) {
+            auction.placeBid((UserId)(1 + i % bidders), 1.0 + (double)i);
+        });
+    }
+
+    void benchSystemPlaceBid(const string& name, size_t hotCount, ZipfSampler* zipf = nullptr) {
+        AuctionSystem system;
+        system.getBidReporter().setMode(ReportMode::Silent);
+        vector<Session> sessions;
+        populate(system, sessions);
+        vector<BidOp> ops = makeBids(options.bids, options.auctions, hotCount, options.hotShare, zipf);
+        measure(name, ops.size(), [&](size_t i) {
+            system.placeBid(sessions[ops[i].user], ops[i].item, ops[i].amount);
+        });
+    }
+
+    void benchSharded(const string& name, size_t hotCount) {
+        AuctionSystem system;
+        system.getBidReporter().setMode(ReportMode::Silent);
+        vector<Session> sessions;
+        populate(system, sessions);
+        vector<BidOp> ops = makeBids(options.bids, options.auctions, hotCount, options.hotShare);
+        system.enableSharding(options.shards);
+        auto start = steady_clock::now();
+        for (const auto& op : ops) {
+            system.submitBidAsync(sessions[op.user], op.item, op.amount);
+        }
+        system.getShardEngine()->drain();
+        double seconds = duration<double>(steady_clock::now() - start).count();
+        system.disableSharding();
+        report(name + "/" + to_string(options.shards) + "sh", ops.size(), seconds, nullptr);
+    }
+
+    void benchQueries() {
+        AuctionSystem system;
+        system.getBidReporter().setMode(ReportMode::Silent);
+        vector<Session> sessions;
+
+        measure("registerUser", options.users, [&](size_t i) {
+            system.registerUser("bench" + to_string(i), "bench@example.com", 1e15);
+            Session session;
+            session.userId = (UserId)i;
+            sessions.push_back(session);
+        });
+
+        static const char* words[] = {"vintage", "camera", "lamp", "watch", "guitar", "bike", "rare", "coin", "poster", "vinyl"};
+        for (size_t a = 0; a < options.auctions; a++) {
+            string name = string(words[a % 10]) + " " + words[(a / 10) % 10];
+            system.addAuction(sessions[0], name, "lot " + to_string(a) + " " + words[(a * 7) % 10], 0.5, 10.0, 600);
+        }
+        for (const auto& op : makeBids(options.bids, options.auctions, 0, 0.0)) {
+            system.submitBid(sessions[op.user], op.item, op.amount);
+        }
+
+        measure("searchAuctions", options.queries, [&](size_t i) {
+            system.searchAuctions(string(words[i % 10]) + " " + words[(i / 10) % 10]);
+        });
+
+        vector<string> itemNames;
+        for (size_t a = 0; a < options.auctions; a++) {
+            itemNames.push_back(system.itemName((ItemId)a));
+        }
+        measure("displayTopBidders", options.queries, [&](size_t i) {
+            system.displayTopBidders(itemNames[i % itemNames.size()]);
+        });
+        measure("endAuction", itemNames.size(), [&](size_t i) {
+            system.endAuction(itemNames[i]);
+        });
+    }
+
+public:
+    Benchmark(const BenchOptions& benchOptions, ostream& output)
+        : options(benchOptions), out(output), rng(benchOptions.seed) {
+        options.users = max<size_t>(2, options.users);
+        options.auctions = max<size_t>(1, options.auctions);
+        options.hotAuctions = min(options.hotAuctions, options.auctions);
+    }
+
+    void run() {
+        out << "bids=" << options.bids << " users=" << options.users << " auctions=" << options.auctions
+            << " hot=" << options.hotAuctions << " (" << options.hotShare * 100 << "% of bids) shards=" << options.shards << endl;
+        benchAuctionPlaceBid();
+        benchSystemPlaceBid("placeBid/uniform", 0);
+        benchSystemPlaceBid("placeBid/hot", options.hotAuctions);
+        ZipfSampler zipf(options.auctions, options.zipf);
+        benchSystemPlaceBid("placeBid/zipf", 0, &zipf);
+        benchSharded("placeBidAsync/uniform", 0);
+        benchSharded("placeBidAsync/hot", options.hotAuctions);
+        benchQueries();
+    }
+};
+
+// Writes a synthetic batch stream (`index --generate`) for replay with
+// --batch: options.users users, options.auctions auctions owned by the first
+// of them, then options.bids bids from random users on zipf-distributed
+// auctions. Bids mostly climb, with one in ten below the current price; at a
+// nonzero options.rate they arrive as a Poisson process, stamped with T lines.
+// Display IDs are those a fresh system hands out.
+class LoadGenerator {
+private:
+    BenchOptions options;
+    mt19937_64 rng;
+    
+public:
+    explicit LoadGenerator(const BenchOptions& generatorOptions)
+        : options(generatorOptions), rng(generatorOptions.seed) {
+        options.users = max<size_t>(2, options.users);
+        options.auctions = max<size_t>(1, options.auctions);
+    }
+    
+    void write(ostream& out) {
+        out << "# generated: users=" << options.users << " auctions=" << options.auctions << " bids=" << options.bids
+            << " zipf=" << options.zipf << " rate=" << options.rate << " seed=" << options.seed << '\n';
+        out << setprecision(15);
+        for (size_t u = 0; u < options.users; u++) {
+            out << "R gen" << u << " gen" << u << "@example.com 1e12\n";
+        }
+        // Long enough that nothing expires before the last bid
+        double span = options.rate > 0 ? (double)options.bids / options.rate : 0.0;
+        int minutes = (int)min(1e6, 60.0 + span / 30.0);
+        out << "L gen0\n";
+        for (size_t a = 0; a < options.auctions; a++) {
+            out << "C 1 10 " << minutes << " lot " << a << "|generated lot " << a << '\n';
+        }
+        
+        size_t firstItem = 1000 + options.users;
+        ZipfSampler zipf(options.auctions, options.zipf);
+        exponential_distribution<double> gap(options.rate > 0 ? options.rate : 1.0);
+        vector<double> price(options.auctions, 1.0);
+        double at = 0.0;
+        if (options.rate > 0) {
+            out << "T 0\n";
+        }
+        for (size_t i = 0; i < options.bids; i++) {
+            size_t auction = zipf(rng);
+            double amount;
+            if (rng() % 10 == 0) {
+                amount = price[auction] * 0.5;
+            } else {
+                price[auction] += 1.0 + (double)(rng() % 5);
+                amount = price[auction];
+            }
+            if (options.rate > 0) {
+                at += gap(rng);
+                out << "T " << fixed << setprecision(6) << at << defaultfloat << setprecision(15) << '\n';
+            }
+            out << "L gen" << 1 + rng() % (options.users - 1) << '\n';
+            out << "B ID" << firstItem + auction << ' ' << amount << '\n';
+        }
+    }
+};
+
+// Prints a batch run's throughput and, per command, its latency percentiles
+static void printBatchStats(const BatchStats& stats, size_t executed, double seconds, ostream& out) {
+    out << "Throughput: " << fixed << setprecision(0) << (seconds > 0 ? executed / seconds : 0.0) << " commands/s"
+        << defaultfloat << setprecision(6) << endl;
+    for (int letter = 0; letter < 26; letter++) {
+        const LatencyHistogram& latency = stats.latency[letter];
+        if (latency.count() == 0) {
+            continue;
+        }
+        out << "  " << (char)('A' + letter) << right << setw(10) << latency.count()
+            << "  p50 " << setw(7) << formatNanos(latency.percentile(0.50))
+            << "  p99 " << setw(7) << formatNanos(latency.percentile(0.99))
+            << "  p999 " << setw(7) << formatNanos(latency.percentile(0.999))
+            << "  max " << setw(7) << formatNanos(latency.max()) << endl;
+    }
+}
+
+// Writes AuctionSystem::metricsLogLine to stderr at a fixed interval until destroyed
+class MetricsLogger {
+private:
+    const AuctionSystem& system;
+    duration<double> interval;
+    mutex lock;
+    condition_variable wake;
+    bool stopping = false;
+    thread worker;
+    
+public:
+    MetricsLogger(const AuctionSystem& sys, double intervalSeconds) : system(sys), interval(intervalSeconds) {
+        worker = thread([this] {
+            unique_lock<mutex> guard(lock);
+            while (!wake.wait_for(guard, interval, [this] { return stopping; })) {
+                cerr << system.metricsLogLine() << endl;
             }
+        });
+    }
+    
+    ~MetricsLogger() {
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
         }
+        wake.notify_one();
+        worker.join();
     }
 };
 
+static void printUsage(const char* program) {
+    cerr << "Usage: " << program << " [--batch [file]] [--quiet] | --bench [bench options] | --generate [generator options]" << endl;
+    cerr << "  --batch [file]  execute commands from file (or stdin when omitted / '-')" << endl;
+    cerr << "  --users <file>  bulk-register users from lines of \"username email [balance]\"" << endl;
+    cerr << "  --data-dir <dir> keep state in dir (snapshot + write-ahead log) across restarts" << endl;
+    cerr << "  --archive <file> move bid logs of settled auctions to file (on by default with --data-dir)" << endl;
+    cerr << "  --increment <x> step proxy bids outbid rivals by (default: 1)" << endl;
+    cerr << "  --metrics-interval <s> log a metrics line to stderr every s seconds (needs -DAUCTION_METRICS)" << endl;
+    cerr << "  --serve <port>  answer binary protocol requests over TCP (0 picks a free port)" << endl;
+    cerr << "  --follow <host:port> with --serve, replicate the leader server at host:port and serve reads only" << endl;
+    cerr << "  --bid-rate <r>[:<burst>] admit at most r bids per second per user (default: unlimited)" << endl;
+    cerr << "  --record <file> write the commands served or executed, with timestamps, as a batch stream" << endl;
+    cerr << "  --speed <x>|max replay a recorded stream's T lines at x times their pace (default: 1)" << endl;
+    cerr << "  --stats         report throughput and per-command latency after a batch" << endl;
+    cerr << "  --quiet         discard command output in batch mode" << endl;
+    cerr << "  --bid-report=immediate|buffered|off" << endl;
+    cerr << "                  how bid results are reported (default: immediate)" << endl;
+    cerr << "  --bench         run the synthetic benchmark suite; options:" << endl;
+    cerr << "                  --bids N --users N --auctions N --hot N --hot-share F --shards N --queries N --seed N --zipf S" << endl;
+    cerr << "  --generate      write a synthetic batch stream to stdout; options:" << endl;
+    cerr << "                  --bids N --users N --auctions N --zipf S --rate BIDS_PER_SEC --seed N" << endl;
+}
+
+int main(int argc, char* argv[]) {
+    bool batch = false;
+    bool quiet = false;
+    string batchFile = "-";
+    ReportMode reportMode = ReportMode::Immediate;
+    string usersFile;
+    string dataDir;
+    string archiveFile;
+    double proxyIncrement = 1.0;
+    double metricsInterval = 0.0;
+    int servePort = -1;
+    string leaderAddress;
+    double bidRate = 0.0;
+    double bidBurst = 0.0;
+    bool bench = false;
+    bool generate = false;
+    BenchOptions benchOptions;
+    string recordFile;
+    double replaySpeed = 1.0;
+    bool batchStats = false;
+
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--bench") {
+            bench = true;
+        } else if (arg == "--generate") {
+            generate = true;
+        } else if (arg == "--bids" && hasValue) {
+            benchOptions.bids = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--users" && hasValue && (bench || generate)) {
+            benchOptions.users = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--auctions" && hasValue) {
+            benchOptions.auctions = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--hot" && hasValue) {
+            benchOptions.hotAuctions = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--hot-share" && hasValue) {
+            benchOptions.hotShare = strtod(argv[++i], nullptr);
+        } else if (arg == "--shards" && hasValue) {
+            benchOptions.shards = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--queries" && hasValue) {
+            benchOptions.queries = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--seed" && hasValue) {
+            benchOptions.seed = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--zipf" && hasValue) {
+            benchOptions.zipf = strtod(argv[++i], nullptr);
+        } else if (arg == "--rate" && hasValue) {
+            benchOptions.rate = max(0.0, strtod(argv[++i], nullptr));
+        } else if (arg == "--record" && hasValue) {
+            recordFile = argv[++i];
+        } else if (arg == "--speed" && hasValue) {
+            string speed = argv[++i];
+            replaySpeed = speed == "max" ? 0.0 : strtod(speed.c_str(), nullptr);
+            if (!(replaySpeed >= 0)) {
+                printUsage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--stats") {
+            batchStats = true;
+        } else if (arg == "--batch") {
+            batch = true;
+            if (i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0) {
+                batchFile = argv[++i];
+            }
+        } else if (arg == "--users" && i + 1 < argc) {
+            usersFile = argv[++i];
+        } else if (arg == "--data-dir" && hasValue) {
+            dataDir = argv[++i];
+        } else if (arg == "--archive" && hasValue) {
+            archiveFile = argv[++i];
+        } else if (arg == "--increment" && hasValue) {
+            proxyIncrement = strtod(argv[++i], nullptr);
+            if (!(proxyIncrement > 0)) {
+                printUsage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--metrics-interval" && hasValue) {
+            metricsInterval = strtod(argv[++i], nullptr);
+        } else if (arg == "--follow" && hasValue) {
+            leaderAddress = argv[++i];
+        } else if (arg == "--serve" && hasValue) {
+            servePort = atoi(argv[++i]);
+            if (servePort < 0 || servePort > 65535) {
+                printUsage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--bid-rate" && hasValue) {
+            // R or R:burst; the burst defaults to one second's worth
+            char* end = nullptr;
+            bidRate = strtod(argv[++i], &end);
+            bidBurst = *end == ':' ? strtod(end + 1, nullptr) : bidRate;
+            if (!(bidRate >= 0) || !(bidBurst >= 0)) {
+                printUsage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--quiet") {
+            quiet = true;
+        } else if (arg == "--bid-report=immediate") {
+            reportMode = ReportMode::Immediate;
+        } else if (arg == "--bid-report=buffered") {
+            reportMode = ReportMode::Buffered;
+        } else if (arg == "--bid-report=off") {
+            reportMode = ReportMode::Silent;
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    // A follower's state comes only from its leader
+    size_t leaderColon = leaderAddress.rfind(':');
+    if (!leaderAddress.empty() && (servePort < 0 || batch || !dataDir.empty() || !archiveFile.empty() ||
+                                   !usersFile.empty() || leaderColon == string::npos)) {
+        cerr << "--follow takes host:port, needs --serve and cannot be combined with --batch, --data-dir, --archive or --users" << endl;
+        return 1;
+    }
+
+    if (bench) {
+        ios::sync_with_stdio(false);
+        NullSink nullSink;
+        ostream results(cout.rdbuf());
+        streambuf* original = cout.rdbuf(&nullSink);
+        Benchmark(benchOptions, results).run();
+        cout.rdbuf(original);
+        return 0;
+    }
 
+    if (generate) {
+        ios::sync_with_stdio(false);
+        LoadGenerator(benchOptions).write(cout);
+        return 0;
+    }
 
-int main() {
     AuctionSystem system;
-    system.run();
+    system.setProxyIncrement(proxyIncrement);
+    system.setReplaySpeed(replaySpeed);
+
+    CommandRecorder recorder;
+    if (!recordFile.empty() && !recorder.open(recordFile)) {
+        return 1;
+    }
+    CommandRecorder* activeRecorder = recordFile.empty() ? nullptr : &recorder;
+
+    if (!dataDir.empty() && !system.enablePersistence(dataDir)) {
+        return 1;
+    }
+    if (!archiveFile.empty() && !system.enableArchive(archiveFile)) {
+        return 1;
+    }
+
+    system.setBidRateLimit(bidRate, bidBurst);
+
+    unique_ptr<MetricsLogger> metricsLogger;
+    if (metricsInterval > 0) {
+        metricsLogger = make_unique<MetricsLogger>(system, metricsInterval);
+    }
+
+    if (!usersFile.empty()) {
+        ifstream users(usersFile);
+        if (!users) {
+            cerr << "Cannot open users file: " << usersFile << endl;
+            return 1;
+        }
+        // Size the tables up front from the line count
+        size_t lines = (size_t)count(istreambuf_iterator<char>(users), istreambuf_iterator<char>(), '\n');
+        users.clear();
+        users.seekg(0);
+        size_t registered = system.registerUsersFromStream(users, lines);
+        cerr << "Registered " << registered << " users from " << usersFile << endl;
+    }
+
+    if (servePort >= 0) {
+#ifdef __linux__
+        static AuctionServer* activeServer = nullptr;
+        AuctionServer server(system);
+        if (!server.listen((uint16_t)servePort)) {
+            return 1;
+        }
+        server.setRecorder(activeRecorder);
+        if (!leaderAddress.empty() &&
+            !server.follow(leaderAddress.substr(0, leaderColon), (uint16_t)atoi(leaderAddress.c_str() + leaderColon + 1))) {
+            return 1;
+        }
+        activeServer = &server;
+        signal(SIGINT, [](int) { activeServer->stop(); });
+        signal(SIGTERM, [](int) { activeServer->stop(); });
+        cerr << "Serving on port " << server.port() << endl;
+        server.run();
+        if (!dataDir.empty()) {
+            system.checkpoint();
+        }
+        return 0;
+#else
+        cerr << "--serve is only supported on Linux" << endl;
+        return 1;
+#endif
+    }
+
+    if (!batch) {
+        system.run();
+        if (!dataDir.empty()) {
+            system.checkpoint();
+        }
+        return 0;
+    }
+
+    ios::sync_with_stdio(false);
+
+    ifstream file;
+    istream* in = &cin;
+    if (batchFile != "-") {
+        file.open(batchFile);
+        if (!file) {
+            cerr << "Cannot open batch file: " << batchFile << endl;
+            return 1;
+        }
+        in = &file;
+    }
+
+    BufferedSink bufferedSink(stdout);
+    NullSink nullSink;
+    streambuf* original = cout.rdbuf(quiet ? (streambuf*)&nullSink : (streambuf*)&bufferedSink);
+    system.getBidReporter().setMode(quiet ? ReportMode::Silent : reportMode);
+
+    BatchStats stats;
+    auto start = steady_clock::now();
+    size_t executed = system.runBatch(*in, activeRecorder, batchStats ? &stats : nullptr);
+    system.getBidReporter().flush();
+    auto elapsed = duration_cast<microseconds>(steady_clock::now() - start).count();
+
+    cout.rdbuf(original);
+    bufferedSink.flushNow();
+
+    if (!dataDir.empty()) {
+        system.checkpoint();
+    }
+
+    cerr << "Executed " << executed << " commands in " << elapsed / 1000.0 << " ms" << endl;
+    if (batchStats) {
+        printBatchStats(stats, executed, elapsed / 1e6, cerr);
+    }
     return 0;
 }
\ No newline at end of file